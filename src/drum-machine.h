@@ -19,53 +19,337 @@
 #ifndef DRUM_MACHINE_H
 #define DRUM_MACHINE_H
 
+// Legacy EEPROM layout, only read to take the settings over
 const int MAX_MODES = 30;
 const int INSTR_STORE_MAX_SIZE = 80;
 
-const int RHYTHM_MAX_NOTES = 128;
+// Number of styles (see Mode in drum-machine.ino). Every instrument has a
+// rhythm and a break collection for each of them.
+const unsigned char mode_count = 5;
+
+// Number of entries in the instrument table instrs
+const int instrument_count = 5;
+
+const int RHYTHM_NAME_SIZE = 16;
+const int INSTRUMENT_NAME_SIZE = 12;
+const int SONG_NAME_SIZE = 16;
+const int GROOVE_NAME_SIZE = 12;
+const int GROOVE_STEPS = 16; // sixteenths of a 4/4 bar
+const int CURVE_NAME_SIZE = 12;
+
+#ifndef pgm_read_ptr
+#define pgm_read_ptr(addr) ((const void*) pgm_read_word(addr))
+#endif
 
 struct Rhythm {
-  /* Describes the rhythm for a time signature for an instrument */
-  char name[32];
-  int numerator;
-  int denominator;
+  /*
+  Describes the rhythm for a time signature for an instrument.
+  Rhythms and their notes live in flash (PROGMEM) and are read in place.
+  */
+  char name[RHYTHM_NAME_SIZE];
+  unsigned char numerator;
+  unsigned char denominator;
 
   /*
   Describes whether the notes have to be seen as semibreve, half note,
   quarter note, etc.
   */
-  int subdivision;
+  unsigned char subdivision;
+  unsigned char note_count; /* length of *notes* */
   /*
   Describe whether the instrument has to play.
   0 = not playing.
   1 - 0x7f=playing with volume ~
   */
-  unsigned char* notes;
-  int note_count; /* length of *notes* */
+  const unsigned char* notes;
 };
 
-// Functions to set parameters of a Rhythm instance.
-// All rhythm data in local function -> less RAM usage
-typedef void (*r_func)(Rhythm*);
+const int SCHEDULE_MAX_EVENTS = 32;
+
+struct Event {
+  /* A note of a Rhythm placed on the tick it sounds on */
+  unsigned int tick; // relative to the start of the rhythm
+  unsigned char velocity;
+};
+
+struct Schedule {
+  /*
+  A Rhythm compiled into its sounding notes. Played by counting ticks, so
+  a step without a note costs one comparison.
+  */
+  Event events[SCHEDULE_MAX_EVENTS]; // sorted by tick
+  unsigned char event_count;
+  unsigned int length; // ticks until the rhythm repeats, 0 = silent
+  unsigned int pos; // tick that is played next
+  unsigned char next; // index of the next event to play
+  // time signature of the rhythm
+  unsigned int bar; // ticks
+  unsigned char beats;
+};
 
 struct RhythmCollection {
-  r_func* rhythms;
-  int rhythm_count;
-  int cur_rhythm;
+  /* The rhythms to choose from for one mode. Lives in flash. */
+  const Rhythm* const* rhythms;
+  unsigned char rhythm_count;
+};
+
+// What an instrument plays in the last bar of a phrase (see computeFill)
+enum FillRole {
+  FILL_KEEP, // its rhythm
+  FILL_DENSER, // more notes towards the end of the bar
+  FILL_ROLL, // a roll growing louder over the last two beats
+  FILL_CRASH // its rhythm and a crash on the next downbeat
 };
 
 struct Instrument {
-  /* Describes an instrument */
-  int uid; // Unique identifier/relative position in EEPROM
-  char name[32];
-  int midi_note;
-  int input_pin;
+  /*
+  Describes an instrument. All instruments are in the flash table instrs,
+  their position in it identifies them in EEPROM.
+  */
+  char name[INSTRUMENT_NAME_SIZE];
+  unsigned char midi_note;
+  unsigned char input_pin;
+  unsigned char gate; // ticks until the note off, 1 to NOTE_WHEEL_SIZE - 1
+  // humanize: chance to play in %, +- velocity, up to timing ticks late
+  unsigned char probability;
+  unsigned char velocity_spread;
+  unsigned char timing_spread; // less than NOTE_WHEEL_SIZE - gate
+  unsigned char fill; // FillRole
+
+  const RhythmCollection* rhythms; // one per mode
+  const RhythmCollection* breaks;
+};
+
+struct Groove {
+  /*
+  Timing and dynamics of the notes on the sixteenths of a bar, applied
+  when a rhythm is compiled. Stored in flash.
+  */
+  char name[GROOVE_NAME_SIZE];
+  signed char offsets[GROOVE_STEPS]; // ticks, negative = early
+  unsigned char levels[GROOVE_STEPS]; // velocity * level / 128
+};
 
-  RhythmCollection* rhythms;
-  RhythmCollection* breaks;
+struct VelocityCurve {
+  /*
+  Response of a sound module: the velocity sent for every velocity
+  played, looked up once per note. Stored in flash.
+  */
+  char name[CURVE_NAME_SIZE];
+  unsigned char levels[128]; // 1 or more for 1 to 127
+};
+
+struct ModeFeel {
+  /* Feel of a mode, changes at runtime */
+  unsigned char swing; // position of the offbeat eighth in %, 50 = straight
+  unsigned char groove; // index into grooves
+};
+
+struct SongEntry {
+  /* A part of a song, stored in flash */
+  unsigned char mode;
+  unsigned char rhythms[instrument_count]; // index in the mode's collection
+  unsigned char is_break; // play the selected breaks
+  unsigned char bars;
+};
+
+struct Song {
+  char name[SONG_NAME_SIZE];
+  const SongEntry* entries;
+  unsigned char entry_count;
+};
+
+struct InstrumentState {
+  /* The part of an Instrument that changes at runtime */
+  // [rhythm, break][mode]: a number into the rhythms in flash, or
+  // PATTERN_CHOICE plus the slot of a user pattern, so a selection stays
+  // on its pattern when others are stored or deleted
+  unsigned char cur_rhythms[2][mode_count];
+};
+
+struct Voice {
+  /* What the step interrupt needs to play an Instrument */
+  Schedule* layers[2]; // playing: rhythm, break
+  // prepared for the next song entry (both) or fill (break), else unused
+  Schedule* standby[2];
+  // a new selection waiting for cue_step, layers with their bit in cued
+  Schedule* cue[2];
+  unsigned char cued;
+  Schedule schedules[6];
+  unsigned char midi_note;
+  unsigned char pot; // velocity pot, index into pot_levels
+  unsigned char gate;
+  unsigned char off_slot; // wheel slot of the pending note off or NO_NOTE_OFF
+  unsigned char probability;
+  unsigned char velocity_spread;
+  unsigned char timing_spread;
+  unsigned char delay_slot; // wheel slot of a delayed note on or NO_NOTE_OFF
+  unsigned char delayed_velocity;
+  const unsigned char* curve; // levels of a VelocityCurve, in flash
+};
+
+// Pending note offs: one slot per tick, a bit per instrument
+const int NOTE_WHEEL_SIZE = 64; // power of two, longest gate + 1
+const unsigned char NO_NOTE_OFF = 0xff;
+
+const int POT_MAX_COUNT = 8;
+
+// Joystick and footswitches, the bits of the debounced button state
+enum Button {
+  BUTTON_UP,
+  BUTTON_DOWN,
+  BUTTON_LEFT,
+  BUTTON_RIGHT,
+  BUTTON_ENTER,
+  BUTTON_BREAK,
+  BUTTON_MUTE
+};
+const int BUTTON_QUEUE_SIZE = 16; // power of two
+const unsigned char BUTTON_PRESSED = 0x80; // in an event, else released
+
+const int MIDI_PORT_COUNT = 2;
+const int MIDI_QUEUE_SIZE = 64; // power of two
+const int MIDI_REALTIME_QUEUE_SIZE = 8; // power of two
+
+struct MidiPort {
+  /*
+  Transmit queue of one UART. Filled by loop() and the step interrupt,
+  emptied by the UART data register empty interrupt. Real-time messages
+  have their own queue and go out before anything else.
+  */
+  unsigned char queue[MIDI_QUEUE_SIZE];
+  volatile unsigned char head; // next byte to send
+  volatile unsigned char tail; // next free slot
+  unsigned char realtime[MIDI_REALTIME_QUEUE_SIZE];
+  volatile unsigned char realtime_head;
+  volatile unsigned char realtime_tail;
+  boolean running_status; // leave out repeated status bytes
+  unsigned char last_status; // 0 = none
+  unsigned int overflows; // messages dropped because the queue was full
+};
+
+// SysEx pattern transfer: F0 7D 01 command ... F7, see README.md
+const unsigned char SYSEX_ID = 0x7d; // non-commercial
+const unsigned char SYSEX_DEVICE = 0x01;
+const int SYSEX_MAX_SIZE = 24; // bytes between F0 and F7
+const int SYSEX_CHUNK_SIZE = 16; // pattern bytes per data message
+
+enum SysExCommand {
+  SYSEX_DUMP_REQUEST = 0x01, // slot or SYSEX_ALL_SLOTS
+  SYSEX_DELETE = 0x02, // slot
+  SYSEX_BEGIN = 0x10, // slot
+  SYSEX_DATA = 0x11, // offset, up to SYSEX_CHUNK_SIZE bytes
+  SYSEX_END = 0x12, // CRC in three 7 bit bytes, lowest first
+  SYSEX_STATUS = 0x20 // slot, SysExStatus
+};
+const unsigned char SYSEX_ALL_SLOTS = 0x7f;
+
+enum SysExStatus {
+  SYSEX_OK,
+  SYSEX_CRC_ERROR, // or a data message got lost
+  SYSEX_BUSY, // still writing or dumping, try again
+  SYSEX_INVALID // bad slot or pattern, empty slot
+};
+
+struct MidiParser {
+  /* Receive state of one UART */
+  unsigned char status; // 0 = ignore data bytes
+  unsigned char data[2];
+  unsigned char count; // data bytes received
+  unsigned char length; // data bytes of status
+  // a SysEx message, handed to loop() with sysex_ready
+  unsigned char sysex[SYSEX_MAX_SIZE];
+  unsigned char sysex_length;
+  boolean sysex_overflow; // too long or came while the last was not read
+  volatile boolean sysex_ready;
+};
+
+// Where a new rhythm, break or the break switch takes over
+enum Quantize {
+  QUANTIZE_BAR, // the default
+  QUANTIZE_BEAT,
+  QUANTIZE_STEP // the next tick
+};
+const int quantize_count = 3;
+
+// Settings log: every flush writes a Settings record into the next slot
+// of a ring, so the writes spread over all slots. A record is a sequence
+// number, the Settings and the CRC-16 of both; the newest valid one wins.
+const unsigned char SETTINGS_VERSION = 1;
+const int SETTINGS_SLOT_SIZE = 128;
+const int SETTINGS_SLOT_COUNT = 8;
+const unsigned long SETTINGS_QUIET_MS = 2000; // flush after no change
+
+struct Settings {
+  /* What is kept over power cycles, the RAM shadow of the settings log */
+  unsigned char version; // SETTINGS_VERSION
+  unsigned char mode;
+  unsigned char rhythms[instrument_count][2][mode_count]; // see cur_rhythms
+  unsigned char curves[instrument_count]; // index into velocity_curves
+  unsigned char quantize; // Quantize
+  unsigned char humanize;
+  uint16_t humanize_seed;
+  ModeFeel feels[mode_count]; // see mode_feels
+  unsigned char fill_bars; // 0, 4 or 8
+};
+
+// User patterns, stored in EEPROM slots from pattern_store_pos on. A slot
+// is a PatternHeader, the notes, and at its end the CRC-16 of both.
+const unsigned char PATTERN_VERSION = 1;
+const int PATTERN_SLOT_SIZE = 128;
+const int PATTERN_SLOT_COUNT = 24;
+const int PATTERN_CRC_POS = PATTERN_SLOT_SIZE - 2;
+const unsigned char NO_PATTERN = 0xff;
+const unsigned char PATTERN_CHOICE = 0x80; // see cur_rhythms
+
+struct PatternHeader {
+  /* A user pattern in EEPROM, all bytes 7 bit as they come over SysEx */
+  unsigned char version; // PATTERN_VERSION, anything else is empty
+  unsigned char instrument;
+  unsigned char layer; // 0 rhythm, 1 break
+  unsigned char mode;
+  // like Rhythm
+  unsigned char numerator;
+  unsigned char denominator;
+  unsigned char subdivision;
+  unsigned char note_count;
+  char name[RHYTHM_NAME_SIZE]; // padded with 0
+};
+
+const int PATTERN_MAX_NOTES = PATTERN_CRC_POS - sizeof(PatternHeader);
+
+const int MIDI_IN_QUEUE_SIZE = 16; // power of two
+
+struct MidiMessage {
+  /* A received channel message for loop() */
+  unsigned char status;
+  unsigned char data[2];
+};
+
+const int LATENCY_BUCKETS = 16;
+const int LATENCY_BUCKET_US = 256;
+const int LATENCY_MARK_COUNT = 16; // power of two
+
+struct LatencyStats {
+  /*
+  Time from the tick of a note to the first byte of its note on
+  going into the DIN UART, in microseconds. Jitter is the difference
+  between two following latencies of the same instrument.
+  */
+  unsigned int min;
+  unsigned int max;
+  unsigned long sum;
+  unsigned int count;
+  unsigned int last;
+  unsigned int latency[LATENCY_BUCKETS];
+  unsigned int jitter[LATENCY_BUCKETS];
+};
 
-  Rhythm cur_rhythm;
-  Rhythm cur_break;
+struct LatencyMark {
+  /* A queued note on waiting to be sent */
+  unsigned long due; // micros() of its tick
+  unsigned char pos; // queue position of its first byte
+  unsigned char instr;
 };
 
 class View {
@@ -81,819 +365,593 @@ public:
 
 void setup();
 void loop();
+void beginMIDI();
+boolean queueMIDI(int, const unsigned char*, int);
+boolean queueRealtimeMIDI(int, unsigned char);
+void transmitMIDI(int);
 void sendMIDI(const int, const int, const int);
 void sendShortMIDI(const int, const int);
-void computeStep(int);
+void sendRealtimeMIDI(const int);
+void sendNote(int, int, unsigned long);
+void sendNoteOff(int);
+void flushNotes();
+void startNote(int, int, unsigned long, unsigned char);
+void seedRandom(uint16_t);
+uint16_t nextRandom();
+unsigned char addPot(unsigned char);
+void startPotScanner();
+int getPotReading(unsigned char);
+void computeClock();
+void playTick();
+void seekSchedule(Schedule*, long);
+void seekVoices(long);
+void updateMeter();
+long getBarStep(long);
+unsigned int getBarTicks();
+unsigned int getBeatTicks();
+void receiveMIDI(int, unsigned char);
+void receiveRealtimeMIDI(unsigned char);
+void dispatchMIDI(unsigned char, const unsigned char*);
+void computeMIDIInput();
+void setRhythm(int, int, int);
+void computeSysEx();
+void handleSysEx(int, const unsigned char*, int);
+void sendSysExStatus(int, int, int);
+boolean queueSysEx(int, unsigned char, const unsigned char*, int);
+int getMIDIQueueFree(int);
+uint16_t updateCRC(uint16_t, unsigned char);
+boolean checkPattern(const unsigned char*, int);
+int getPatternPos(int);
+unsigned char getPatternKey(int, int, int);
+void loadPatternIndex();
+int findPattern(int, int, int, int);
+int getChoiceCount(int, int, int);
+int getChoiceSlot(int, int, int, int);
+int getChoiceNumber(int, int, int, int);
+int getChoice(int, int, int, int);
+void compileChoice(int, int, int, int, Schedule*, long);
+void printRhythmName(int, int);
+void startDump(int, int);
+void computeDump();
+void startPatternWriter(int, int, int);
+void computePatternWriter();
+void queueRhythm(int, int, int);
+void enterSlave();
+void computeClockInput();
+boolean updateSlave();
+int getSlaveTempo();
+void startClock();
+void stopClock();
+void recordLatency(int, unsigned int);
+void resetLatency();
+unsigned int getLatencyPercentile(const unsigned int*, unsigned int, int);
+unsigned int getMIDIOverflows(int);
+void computeStep();
 void escapeLCDNum(const int, const int);
-void displayBeat(const int, boolean);
+unsigned int levelToGain(unsigned char);
+unsigned char scaleVelocity(unsigned char, unsigned int);
+void displayBeat(const long, boolean);
 void nextView();
 void prevView();
-boolean computeJoystick();
-boolean computeBreakSwitch();
-boolean computeMuteSwitch();
-long getDelay(long);
-int getLocalStep(int, int, int);
-boolean isLocalStep(int, int);
+unsigned char sampleButtons();
+void startButtonScanner();
+void computeButtons();
+void setTempo(int);
+void startStepTimer();
+long getStepCounter();
+const RhythmCollection* getCollection(int, int, int);
+int getRhythmCount(const RhythmCollection*);
+const Rhythm* getRhythm(const RhythmCollection*, int);
+void insertEvent(Schedule*, unsigned int, unsigned char);
+void compileRhythm(const Rhythm&, int, Schedule*, long, int);
+void loadRhythm(int, int);
+void cueRhythm(int, int);
+void cueBreak(boolean);
+long getCueStep();
+void swapCues();
+void selectRhythm(int, int, int);
+void startSong(int);
+void stopSong();
+void prepareSongEntry(long);
+void computeSong();
+void swapSchedules();
+void buildFill(int, long);
+void computeFill();
+void swapFill();
+void startFill();
+void endFill();
+void playCrash();
+void cancelFill();
 void updateRhythms();
-// getter and setter (for EEPROM)
+void cueRhythms();
+// getter and setter (for the settings)
 int getMode();
 void setMode(int);
-// (de)serializer for EEPROM
-void saveInstrument(Instrument);
-void restoreInstrument(Instrument*);
+int getQuantize();
+void setQuantize(int);
+void setHumanize(boolean, uint16_t);
+// (de)serializer for the settings
+void saveInstrument(int);
+void restoreInstrument(int);
+void saveFeel(int);
+void restoreFeel(int);
+void setCurve(int, int);
+void loadSettings();
+void migrateSettings();
+void resetSettings();
+void markSettingsDirty();
+void computeSettingsStore();
 
 
 // INSTRUMENTS AND RHYTHMS
-void empty_rhythm(Rhythm* r) {
-  const unsigned char notes[] = {0x00};
-  strcpy(r->name, "None");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 1;
-  r->note_count = 1;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-
-r_func empty_rhythm_collection_arr[] {
-  empty_rhythm
+const unsigned char empty_rhythm_notes[] PROGMEM = {
+  0x00
+};
+const Rhythm empty_rhythm PROGMEM = {
+  "None", 4, 4, 1, 1, empty_rhythm_notes
 };
-RhythmCollection empty_rhythm_collection = {
-  empty_rhythm_collection_arr, 1, 0
+
+const Rhythm* const empty_rhythm_collection_arr[] PROGMEM = {
+  &empty_rhythm
 };
-RhythmCollection empty_rhythms[] = {
-  empty_rhythm_collection,
-  empty_rhythm_collection,
-  empty_rhythm_collection,
-  empty_rhythm_collection,
-  empty_rhythm_collection
+const RhythmCollection empty_rhythms[mode_count] PROGMEM = {
+  {empty_rhythm_collection_arr, 1},
+  {empty_rhythm_collection_arr, 1},
+  {empty_rhythm_collection_arr, 1},
+  {empty_rhythm_collection_arr, 1},
+  {empty_rhythm_collection_arr, 1}
 };
 
 /* Bass drum */
 /* Bass drum rhythms */
-void bass_drum_rhythm_4_4(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x75, 0x60, 0x60, 0x60
-  };
-  strcpy(r->name, "1-4");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 4;
-  r->note_count = 4;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-
-void bass_drum_rhythm_offbeat(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x00, 0x60, 0x00, 0x60
-  };
-  strcpy(r->name, "Off Beat");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 4;
-  r->note_count = 4;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-
-void bass_drum_rhythm_beat(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x75, 0x00, 0x60, 0x00
-  };
-  strcpy(r->name, "1+3");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 4;
-  r->note_count = 4;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-
-void bass_drum_rhythm_eigth_feel(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x75, 0x00, 0x00, 0x60, 0x60, 0x00, 0x00, 0x00
-  };
-  strcpy(r->name, "1+2(1/2)+3");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 8;
-  r->note_count = 8;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-
-void bass_drum_rhythm_linear(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x75, 0x00, 0x00, 0x60, 0x00, 0x00, 0x60, 0x00
-  };
-  strcpy(r->name, "1+2(1/2)+4");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 8;
-  r->note_count = 8;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-
-// Play in triplets, but only on first and last
-void bass_drum_rhythm_4_4_jazz(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x70, 0x00, 0x60, 0x00, 0x00, 0x00, 0x70, 0x00, 0x60, 0x00, 0x00, 0x00
-  };
-  strcpy(r->name, "one 'let");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 12;
-  r->note_count = 12;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
+const unsigned char bass_drum_rhythm_4_4_notes[] PROGMEM = {
+  0x75, 0x60, 0x60, 0x60
+};
+const Rhythm bass_drum_rhythm_4_4 PROGMEM = {
+  "1-4", 4, 4, 4, 4, bass_drum_rhythm_4_4_notes
+};
+
+const unsigned char bass_drum_rhythm_offbeat_notes[] PROGMEM = {
+  0x00, 0x60, 0x00, 0x60
+};
+const Rhythm bass_drum_rhythm_offbeat PROGMEM = {
+  "Off Beat", 4, 4, 4, 4, bass_drum_rhythm_offbeat_notes
+};
+
+const unsigned char bass_drum_rhythm_beat_notes[] PROGMEM = {
+  0x75, 0x00, 0x60, 0x00
+};
+const Rhythm bass_drum_rhythm_beat PROGMEM = {
+  "1+3", 4, 4, 4, 4, bass_drum_rhythm_beat_notes
+};
+
+const unsigned char bass_drum_rhythm_eigth_feel_notes[] PROGMEM = {
+  0x75, 0x00, 0x00, 0x60, 0x60, 0x00, 0x00, 0x00
+};
+const Rhythm bass_drum_rhythm_eigth_feel PROGMEM = {
+  "1+2(1/2)+3", 4, 4, 8, 8, bass_drum_rhythm_eigth_feel_notes
+};
+
+const unsigned char bass_drum_rhythm_linear_notes[] PROGMEM = {
+  0x75, 0x00, 0x00, 0x60, 0x00, 0x00, 0x60, 0x00
+};
+const Rhythm bass_drum_rhythm_linear PROGMEM = {
+  "1+2(1/2)+4", 4, 4, 8, 8, bass_drum_rhythm_linear_notes
+};
+
+// Swung eighths: the first and last of a triplet with the jazz swing
+const unsigned char bass_drum_rhythm_4_4_jazz_notes[] PROGMEM = {
+  0x70, 0x60, 0x00, 0x00, 0x70, 0x60, 0x00, 0x00
+};
+const Rhythm bass_drum_rhythm_4_4_jazz PROGMEM = {
+  "one 'let", 4, 4, 8, 8, bass_drum_rhythm_4_4_jazz_notes
+};
 // 3/4
-void bass_drum_rhythm_3_4(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x75, 0x60, 0x60
-  };
-  strcpy(r->name, "3/4 1-3");
-  r->numerator = 3;
-  r->denominator = 4;
-  r->subdivision = 4;
-  r->note_count = 3;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
+const unsigned char bass_drum_rhythm_3_4_notes[] PROGMEM = {
+  0x75, 0x60, 0x60
+};
+const Rhythm bass_drum_rhythm_3_4 PROGMEM = {
+  "3/4 1-3", 3, 4, 4, 3, bass_drum_rhythm_3_4_notes
+};
 
 // Standard rhythms
-r_func bass_standard_rhythms_arr[] = {
-  bass_drum_rhythm_4_4,
-  bass_drum_rhythm_offbeat,
-  bass_drum_rhythm_beat,
-  bass_drum_rhythm_eigth_feel,
-  bass_drum_rhythm_linear
-};
-RhythmCollection bass_standard_rhythms = {
-  bass_standard_rhythms_arr, 5, 0
+const Rhythm* const bass_standard_rhythms_arr[] PROGMEM = {
+  &bass_drum_rhythm_4_4,
+  &bass_drum_rhythm_offbeat,
+  &bass_drum_rhythm_beat,
+  &bass_drum_rhythm_eigth_feel,
+  &bass_drum_rhythm_linear
 };
 
 // Rock rhythms
-r_func bass_rock_rhythms_arr[] = {
-  bass_drum_rhythm_4_4,
-  bass_drum_rhythm_offbeat,
-  bass_drum_rhythm_beat,
-  bass_drum_rhythm_eigth_feel
-};
-RhythmCollection bass_rock_rhythms = {
-  bass_rock_rhythms_arr, 4, 0
+const Rhythm* const bass_rock_rhythms_arr[] PROGMEM = {
+  &bass_drum_rhythm_4_4,
+  &bass_drum_rhythm_offbeat,
+  &bass_drum_rhythm_beat,
+  &bass_drum_rhythm_eigth_feel
 };
 
 // Blues rhythms
-r_func bass_blues_rhythms_arr[] = {
-  bass_drum_rhythm_4_4,
-  bass_drum_rhythm_offbeat,
-  bass_drum_rhythm_beat
-};
-RhythmCollection bass_blues_rhythms = {
-  bass_blues_rhythms_arr, 3, 0
+const Rhythm* const bass_blues_rhythms_arr[] PROGMEM = {
+  &bass_drum_rhythm_4_4,
+  &bass_drum_rhythm_offbeat,
+  &bass_drum_rhythm_beat
 };
 
 // Jazz rhythms
-r_func bass_jazz_rhythms_arr[] = {
-  bass_drum_rhythm_4_4_jazz,
-  bass_drum_rhythm_4_4,
-  bass_drum_rhythm_offbeat,
-  bass_drum_rhythm_beat
-};
-RhythmCollection bass_jazz_rhythms = {
-  bass_jazz_rhythms_arr, 4, 0
+const Rhythm* const bass_jazz_rhythms_arr[] PROGMEM = {
+  &bass_drum_rhythm_4_4_jazz,
+  &bass_drum_rhythm_4_4,
+  &bass_drum_rhythm_offbeat,
+  &bass_drum_rhythm_beat
 };
 
 // Waltz rhythms
-r_func bass_waltz_rhythms_arr[] = {
-  bass_drum_rhythm_3_4
-};
-RhythmCollection bass_waltz_rhythms = {
-  bass_waltz_rhythms_arr, 1, 0
+const Rhythm* const bass_waltz_rhythms_arr[] PROGMEM = {
+  &bass_drum_rhythm_3_4
 };
 
-RhythmCollection bass_rhythms[] = {
-  bass_standard_rhythms,
-  bass_rock_rhythms,
-  bass_blues_rhythms,
-  bass_jazz_rhythms,
-  bass_waltz_rhythms
+const RhythmCollection bass_rhythms[mode_count] PROGMEM = {
+  {bass_standard_rhythms_arr, 5},
+  {bass_rock_rhythms_arr, 4},
+  {bass_blues_rhythms_arr, 3},
+  {bass_jazz_rhythms_arr, 4},
+  {bass_waltz_rhythms_arr, 1}
 };
 
 /* bass drum breaks */
 
 // Standard breaks
-r_func bass_standard_breaks_arr[] = {bass_drum_rhythm_4_4};
-RhythmCollection bass_standard_breaks = {
-  bass_standard_breaks_arr, 1, 0
+const Rhythm* const bass_standard_breaks_arr[] PROGMEM = {
+  &bass_drum_rhythm_4_4
 };
 
 // Rock breaks
-r_func bass_rock_breaks_arr[] = {bass_drum_rhythm_4_4};
-RhythmCollection bass_rock_breaks = {
-  bass_rock_breaks_arr, 1, 0
-};
+const Rhythm* const bass_rock_breaks_arr[] PROGMEM = {&bass_drum_rhythm_4_4};
 
 // Blues breaks
-r_func bass_blues_breaks_arr[] = {bass_drum_rhythm_4_4};
-RhythmCollection bass_blues_breaks = {
-  bass_blues_breaks_arr, 1, 0
-};
+const Rhythm* const bass_blues_breaks_arr[] PROGMEM = {&bass_drum_rhythm_4_4};
 
 // Jazz breaks
-r_func bass_jazz_breaks_arr[] = {bass_drum_rhythm_4_4};
-RhythmCollection bass_jazz_breaks = {
-  bass_jazz_breaks_arr, 1, 0
-};
+const Rhythm* const bass_jazz_breaks_arr[] PROGMEM = {&bass_drum_rhythm_4_4};
 
 // Waltz breaks
-r_func bass_waltz_breaks_arr[] = {bass_drum_rhythm_3_4};
-RhythmCollection bass_waltz_breaks = {
-  bass_waltz_breaks_arr, 1, 0
-};
+const Rhythm* const bass_waltz_breaks_arr[] PROGMEM = {&bass_drum_rhythm_3_4};
 
-RhythmCollection bass_breaks[] = {
-  bass_standard_breaks,
-  bass_rock_breaks,
-  bass_blues_breaks,
-  bass_jazz_breaks,
-  bass_waltz_breaks
+const RhythmCollection bass_breaks[mode_count] PROGMEM = {
+  {bass_standard_breaks_arr, 1},
+  {bass_rock_breaks_arr, 1},
+  {bass_blues_breaks_arr, 1},
+  {bass_jazz_breaks_arr, 1},
+  {bass_waltz_breaks_arr, 1}
 };
 
-unsigned char bass_drum_cur_rhythm_notes[RHYTHM_MAX_NOTES] = {0};
-Rhythm bass_drum_cur_rhythm = {
-  "", 4, 4, 1, bass_drum_cur_rhythm_notes, 0
+
+/* Snare drum */
+/* Snare drum rhythms */
+const unsigned char snare_drum_rhythm_4_4_offbeat_notes[] PROGMEM = {
+  0, 0x40, 0, 0x40
 };
-unsigned char bass_drum_cur_break_notes[RHYTHM_MAX_NOTES] = {0};
-Rhythm bass_drum_cur_break = {
-  "", 4, 4, 1, bass_drum_cur_break_notes, 0
+const Rhythm snare_drum_rhythm_4_4_offbeat PROGMEM = {
+  "Off Beat", 4, 4, 4, 4, snare_drum_rhythm_4_4_offbeat_notes
 };
-Instrument bass_drum = {
-  0, "Bass Drum", 36, A4, bass_rhythms, bass_breaks,
-  bass_drum_cur_rhythm, bass_drum_cur_break
+
+const unsigned char snare_drum_rhythm_4_4_notes[] PROGMEM = {
+  0x75, 0x60, 0x60, 0x60
+};
+const Rhythm snare_drum_rhythm_4_4 PROGMEM = {
+  "1-4", 4, 4, 4, 4, snare_drum_rhythm_4_4_notes
 };
 
-/* Snare drum */
-/* Snare drum rhythms */
-void snare_drum_rhythm_4_4_offbeat(Rhythm* r) {
-  const unsigned char notes[] = {
-    0, 0x40, 0, 0x40
-  };
-  strcpy(r->name, "Off Beat");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 4;
-  r->note_count = 4;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-
-void snare_drum_rhythm_4_4(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x75, 0x60, 0x60, 0x60
-  };
-  strcpy(r->name, "1-4");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 4;
-  r->note_count = 4;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-
-void snare_drum_rhythm_4_4_jazz(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x00, 0x00, 0x00, 0x70, 0x00, 0x60, 0x00, 0x00, 0x00, 0x70, 0x00, 0x60
-  };
-  strcpy(r->name, "2+4: 1+3");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 12;
-  r->note_count = 12;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
+const unsigned char snare_drum_rhythm_4_4_jazz_notes[] PROGMEM = {
+  0x00, 0x00, 0x70, 0x60, 0x00, 0x00, 0x70, 0x60
+};
+const Rhythm snare_drum_rhythm_4_4_jazz PROGMEM = {
+  "2+4: 1+3", 4, 4, 8, 8, snare_drum_rhythm_4_4_jazz_notes
+};
 
 // 3/4
-void snare_drum_rhythm_3_4_waltz_offbeat(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x00, 0x60, 0x60
-  };
-  strcpy(r->name, "3/4 2+3");
-  r->numerator = 3;
-  r->denominator = 4;
-  r->subdivision = 4;
-  r->note_count = 3;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
+const unsigned char snare_drum_rhythm_3_4_waltz_offbeat_notes[] PROGMEM = {
+  0x00, 0x60, 0x60
+};
+const Rhythm snare_drum_rhythm_3_4_waltz_offbeat PROGMEM = {
+  "3/4 2+3", 3, 4, 4, 3, snare_drum_rhythm_3_4_waltz_offbeat_notes
+};
 
 // Standard rhythms
-r_func snare_standard_rhythms_arr[] = {
-  snare_drum_rhythm_4_4_offbeat,
-  snare_drum_rhythm_4_4
-};
-RhythmCollection snare_standard_rhythms = {
-  snare_standard_rhythms_arr, 2, 0
+const Rhythm* const snare_standard_rhythms_arr[] PROGMEM = {
+  &snare_drum_rhythm_4_4_offbeat,
+  &snare_drum_rhythm_4_4
 };
 
 // Rock rhythms
-r_func snare_rock_rhythms_arr[] = {
-  snare_drum_rhythm_4_4_offbeat,
-  snare_drum_rhythm_4_4
-};
-RhythmCollection snare_rock_rhythms = {
-  snare_rock_rhythms_arr, 2, 0
+const Rhythm* const snare_rock_rhythms_arr[] PROGMEM = {
+  &snare_drum_rhythm_4_4_offbeat,
+  &snare_drum_rhythm_4_4
 };
 
 // Blues rhythms
-r_func snare_blues_rhythms_arr[] = {snare_drum_rhythm_4_4_offbeat};
-RhythmCollection snare_blues_rhythms = {
-  snare_blues_rhythms_arr, 1, 0
+const Rhythm* const snare_blues_rhythms_arr[] PROGMEM = {
+  &snare_drum_rhythm_4_4_offbeat
 };
 
 // Jazz rhythms
-r_func snare_jazz_rhythms_arr[] = {snare_drum_rhythm_4_4_jazz};
-RhythmCollection snare_jazz_rhythms = {
-  snare_jazz_rhythms_arr, 1, 0
+const Rhythm* const snare_jazz_rhythms_arr[] PROGMEM = {
+  &snare_drum_rhythm_4_4_jazz
 };
 
 // Waltz rhythms
-r_func snare_waltz_rhythms_arr[] = {
-  snare_drum_rhythm_3_4_waltz_offbeat,
-  empty_rhythm
-};
-RhythmCollection snare_waltz_rhythms = {
-  snare_waltz_rhythms_arr, 2, 0
+const Rhythm* const snare_waltz_rhythms_arr[] PROGMEM = {
+  &snare_drum_rhythm_3_4_waltz_offbeat,
+  &empty_rhythm
 };
 
-RhythmCollection snare_rhythms[] = {
-  snare_standard_rhythms,
-  snare_rock_rhythms,
-  snare_blues_rhythms,
-  snare_jazz_rhythms,
-  snare_waltz_rhythms
+const RhythmCollection snare_rhythms[mode_count] PROGMEM = {
+  {snare_standard_rhythms_arr, 2},
+  {snare_rock_rhythms_arr, 2},
+  {snare_blues_rhythms_arr, 1},
+  {snare_jazz_rhythms_arr, 1},
+  {snare_waltz_rhythms_arr, 2}
 };
 
 /* Snare drum breaks */
 
-void snare_drum_break_standard(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x65, 0x00
-  };
-  strcpy(r->name, "1-7");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 8;
-  r->note_count = 8;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-
-void snare_drum_break_lets(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x00, 0x00, 0x60, 0x00, 0x00, 0x60, 0x00, 0x00, 0x60, 0x00, 0x00, 0x60
-  };
-  strcpy(r->name, "'let");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 12;
-  r->note_count = 12;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
+const unsigned char snare_drum_break_standard_notes[] PROGMEM = {
+  0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x65, 0x00
+};
+const Rhythm snare_drum_break_standard PROGMEM = {
+  "1-7", 4, 4, 8, 8, snare_drum_break_standard_notes
+};
+
+const unsigned char snare_drum_break_lets_notes[] PROGMEM = {
+  0x00, 0x00, 0x60, 0x00, 0x00, 0x60, 0x00, 0x00, 0x60, 0x00, 0x00, 0x60
+};
+const Rhythm snare_drum_break_lets PROGMEM = {
+  "'let", 4, 4, 12, 12, snare_drum_break_lets_notes
+};
 
 // 3/4
-void snare_drum_break_3_4(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x70, 0x00, 0x60, 0x60, 0x00, 0x60, 0x60, 0x00, 0x00
-  };
-  strcpy(r->name, "one'let");
-  r->numerator = 3;
-  r->denominator = 4;
-  r->subdivision = 12;
-  r->note_count = 9;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
+const unsigned char snare_drum_break_3_4_notes[] PROGMEM = {
+  0x70, 0x00, 0x60, 0x60, 0x00, 0x60, 0x60, 0x00, 0x00
+};
+const Rhythm snare_drum_break_3_4 PROGMEM = {
+  "one'let", 3, 4, 12, 9, snare_drum_break_3_4_notes
+};
 
 // Standard breaks
-r_func snare_standard_breaks_arr[] = {
-  snare_drum_break_standard,
-  bass_drum_rhythm_4_4
-};
-RhythmCollection snare_standard_breaks = {
-  snare_standard_breaks_arr, 2, 0
+const Rhythm* const snare_standard_breaks_arr[] PROGMEM = {
+  &snare_drum_break_standard,
+  &bass_drum_rhythm_4_4
 };
 
 // Rock breaks
-r_func snare_rock_breaks_arr[] = {
-  snare_drum_break_standard,
-  bass_drum_rhythm_4_4
-};
-RhythmCollection snare_rock_breaks = {
-  snare_rock_breaks_arr, 2, 0
+const Rhythm* const snare_rock_breaks_arr[] PROGMEM = {
+  &snare_drum_break_standard,
+  &bass_drum_rhythm_4_4
 };
 
 // Blues breaks
-r_func snare_blues_breaks_arr[] = {
-  empty_rhythm,
-  snare_drum_break_lets,
-  bass_drum_rhythm_4_4
-};
-RhythmCollection snare_blues_breaks = {
-  snare_blues_breaks_arr, 3, 0
+const Rhythm* const snare_blues_breaks_arr[] PROGMEM = {
+  &empty_rhythm,
+  &snare_drum_break_lets,
+  &bass_drum_rhythm_4_4
 };
 
 // Jazz breaks
-r_func snare_jazz_breaks_arr[] = {
-  empty_rhythm,
-  snare_drum_break_lets,
-  bass_drum_rhythm_4_4
-};
-RhythmCollection snare_jazz_breaks = {
-  snare_jazz_breaks_arr, 3, 0
+const Rhythm* const snare_jazz_breaks_arr[] PROGMEM = {
+  &empty_rhythm,
+  &snare_drum_break_lets,
+  &bass_drum_rhythm_4_4
 };
 
 // Waltz breaks
-r_func snare_waltz_breaks_arr[] = {
-  empty_rhythm,
-  snare_drum_break_3_4,
-};
-RhythmCollection snare_waltz_breaks = {
-  snare_waltz_breaks_arr, 2, 0
+const Rhythm* const snare_waltz_breaks_arr[] PROGMEM = {
+  &empty_rhythm,
+  &snare_drum_break_3_4,
 };
 
-RhythmCollection snare_breaks[] = {
-  snare_standard_breaks,
-  snare_rock_breaks,
-  snare_blues_breaks,
-  snare_jazz_breaks,
-  snare_waltz_breaks
+const RhythmCollection snare_breaks[mode_count] PROGMEM = {
+  {snare_standard_breaks_arr, 2},
+  {snare_rock_breaks_arr, 2},
+  {snare_blues_breaks_arr, 3},
+  {snare_jazz_breaks_arr, 3},
+  {snare_waltz_breaks_arr, 2}
 };
 
-unsigned char snare_drum_cur_rhythm_notes[RHYTHM_MAX_NOTES] = {0};
-Rhythm snare_drum_cur_rhythm = {
-  "", 4, 4, 1, snare_drum_cur_rhythm_notes, 0
+
+/* Hi-Hat */
+/* Hi-Hat rhythms */
+const unsigned char hi_hat_rhythm_4_4_eights_notes[] PROGMEM = {
+  0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48
 };
-unsigned char snare_drum_cur_break_notes[RHYTHM_MAX_NOTES] = {0};
-Rhythm snare_drum_cur_break = {
-  "", 4, 4, 1, snare_drum_cur_break_notes, 0
+const Rhythm hi_hat_rhythm_4_4_eights PROGMEM = {
+  "1-8", 4, 4, 8, 8, hi_hat_rhythm_4_4_eights_notes
 };
-Instrument snare_drum = {
-  1, "Snare Drum", 38, A1, snare_rhythms, snare_breaks,
-  snare_drum_cur_rhythm, snare_drum_cur_break
+const unsigned char hi_hat_rhythm_4_4_triplets_notes[] PROGMEM = {
+  0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48
+};
+const Rhythm hi_hat_rhythm_4_4_triplets PROGMEM = {
+  "1-12", 4, 4, 12, 12, hi_hat_rhythm_4_4_triplets_notes
 };
 
-/* Hi-Hat */
-/* Hi-Hat rhythms */
-void hi_hat_rhythm_4_4_eights(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48
-  };
-  strcpy(r->name, "1-8");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 8;
-  r->note_count = 8;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-void hi_hat_rhythm_4_4_triplets(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48
-  };
-  strcpy(r->name, "1-12");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 12;
-  r->note_count = 12;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-
-void hi_hat_rhythm_triplets_1_3(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x48, 0x00, 0x40, 0x48, 0x00, 0x40, 0x48, 0x00, 0x40, 0x48, 0x00, 0x40
-  };
-  strcpy(r->name, "One 'let");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 12;
-  r->note_count = 12;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-void hi_hat_rhythm_4_4_offbeat(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x00, 0x48, 0x00, 0x48
-  };
-  strcpy(r->name, "Off Beat");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 4;
-  r->note_count = 4;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
+// swung eighths, see hi_hat_rhythm_4_4_triplets for the full triplets
+const unsigned char hi_hat_rhythm_triplets_1_3_notes[] PROGMEM = {
+  0x48, 0x40, 0x48, 0x40, 0x48, 0x40, 0x48, 0x40
+};
+const Rhythm hi_hat_rhythm_triplets_1_3 PROGMEM = {
+  "One 'let", 4, 4, 8, 8, hi_hat_rhythm_triplets_1_3_notes
+};
+const unsigned char hi_hat_rhythm_4_4_offbeat_notes[] PROGMEM = {
+  0x00, 0x48, 0x00, 0x48
+};
+const Rhythm hi_hat_rhythm_4_4_offbeat PROGMEM = {
+  "Off Beat", 4, 4, 4, 4, hi_hat_rhythm_4_4_offbeat_notes
+};
 
 // 3/4
-void hi_hat_rhythm_3_4_waltz(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x70, 0x00, 0x00, 0x70, 0x00, 0x60, 0x70, 0x00, 0x00
-  };
-  strcpy(r->name, "3/4 1+2+23/3+3");
-  r->numerator = 3;
-  r->denominator = 4;
-  r->subdivision = 12;
-  r->note_count = 9;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-
-void hi_hat_rhythm_3_4_triplets(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48
-  };
-  strcpy(r->name, "1-9");
-  r->numerator = 3;
-  r->denominator = 4;
-  r->subdivision = 12;
-  r->note_count = 9;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
+const unsigned char hi_hat_rhythm_3_4_waltz_notes[] PROGMEM = {
+  0x70, 0x00, 0x00, 0x70, 0x00, 0x60, 0x70, 0x00, 0x00
+};
+const Rhythm hi_hat_rhythm_3_4_waltz PROGMEM = {
+  "3/4 1+2+23/3+3", 3, 4, 12, 9, hi_hat_rhythm_3_4_waltz_notes
+};
 
-// Standard rhythms
-r_func hi_hat_standard_rhythms_arr[] = {
-  hi_hat_rhythm_4_4_eights,
-  hi_hat_rhythm_4_4_offbeat,
-  empty_rhythm
+const unsigned char hi_hat_rhythm_3_4_triplets_notes[] PROGMEM = {
+  0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48, 0x48
 };
-RhythmCollection hi_hat_standard_rhythms = {
-  hi_hat_standard_rhythms_arr, 3, 0
+const Rhythm hi_hat_rhythm_3_4_triplets PROGMEM = {
+  "1-9", 3, 4, 12, 9, hi_hat_rhythm_3_4_triplets_notes
 };
 
-// Rock rhythms
-r_func hi_hat_rock_rhythms_arr[] = {
-  hi_hat_rhythm_4_4_eights,
-  hi_hat_rhythm_4_4_offbeat,
-  empty_rhythm
+// Standard rhythms
+const Rhythm* const hi_hat_standard_rhythms_arr[] PROGMEM = {
+  &hi_hat_rhythm_4_4_eights,
+  &hi_hat_rhythm_4_4_offbeat,
+  &empty_rhythm
 };
-RhythmCollection hi_hat_rock_rhythms = {
-  hi_hat_rock_rhythms_arr, 3, 0
+
+// Rock rhythms
+const Rhythm* const hi_hat_rock_rhythms_arr[] PROGMEM = {
+  &hi_hat_rhythm_4_4_eights,
+  &hi_hat_rhythm_4_4_offbeat,
+  &empty_rhythm
 };
 
 // Blues rhythms
-r_func hi_hat_blues_rhythms_arr[] = {
-  empty_rhythm,
-  hi_hat_rhythm_4_4_triplets,
-  hi_hat_rhythm_triplets_1_3
-};
-RhythmCollection hi_hat_blues_rhythms = {
-  hi_hat_blues_rhythms_arr, 3, 0
+const Rhythm* const hi_hat_blues_rhythms_arr[] PROGMEM = {
+  &empty_rhythm,
+  &hi_hat_rhythm_4_4_triplets,
+  &hi_hat_rhythm_triplets_1_3
 };
 
 // Jazz rhythms
-r_func hi_hat_jazz_rhythms_arr[] = {
-  empty_rhythm,
-  hi_hat_rhythm_4_4_offbeat,
-  hi_hat_rhythm_triplets_1_3,
-  hi_hat_rhythm_4_4_triplets
-};
-RhythmCollection hi_hat_jazz_rhythms = {
-  hi_hat_jazz_rhythms_arr, 4, 0
+const Rhythm* const hi_hat_jazz_rhythms_arr[] PROGMEM = {
+  &empty_rhythm,
+  &hi_hat_rhythm_4_4_offbeat,
+  &hi_hat_rhythm_triplets_1_3,
+  &hi_hat_rhythm_4_4_triplets
 };
 
 // Waltz rhythms
-r_func hi_hat_waltz_rhythms_arr[] = {
-  empty_rhythm,
-  hi_hat_rhythm_3_4_waltz,
-  hi_hat_rhythm_3_4_triplets
-};
-RhythmCollection hi_hat_waltz_rhythms = {
-  hi_hat_waltz_rhythms_arr, 3, 0
+const Rhythm* const hi_hat_waltz_rhythms_arr[] PROGMEM = {
+  &empty_rhythm,
+  &hi_hat_rhythm_3_4_waltz,
+  &hi_hat_rhythm_3_4_triplets
 };
 
-RhythmCollection hi_hat_rhythms[] = {
-  hi_hat_standard_rhythms,
-  hi_hat_rock_rhythms,
-  hi_hat_blues_rhythms,
-  hi_hat_jazz_rhythms,
-  hi_hat_waltz_rhythms
+const RhythmCollection hi_hat_rhythms[mode_count] PROGMEM = {
+  {hi_hat_standard_rhythms_arr, 3},
+  {hi_hat_rock_rhythms_arr, 3},
+  {hi_hat_blues_rhythms_arr, 3},
+  {hi_hat_jazz_rhythms_arr, 4},
+  {hi_hat_waltz_rhythms_arr, 3}
 };
 
 /* Hi-Hat breaks */
-void hi_hat_break_standard(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x60, 0x60, 0x60, 0x65
-  };
-  strcpy(r->name, "1-4");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 4;
-  r->note_count = 4;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
+const unsigned char hi_hat_break_standard_notes[] PROGMEM = {
+  0x60, 0x60, 0x60, 0x65
+};
+const Rhythm hi_hat_break_standard PROGMEM = {
+  "1-4", 4, 4, 4, 4, hi_hat_break_standard_notes
+};
 
 // Standard breaks
-r_func hi_hat_standard_breaks_arr[] = {
-  hi_hat_break_standard,
-  hi_hat_rhythm_4_4_eights,
-  empty_rhythm
-};
-RhythmCollection hi_hat_standard_breaks = {
-  hi_hat_standard_breaks_arr, 3, 0
+const Rhythm* const hi_hat_standard_breaks_arr[] PROGMEM = {
+  &hi_hat_break_standard,
+  &hi_hat_rhythm_4_4_eights,
+  &empty_rhythm
 };
 
 // Rock breaks
-r_func hi_hat_rock_breaks_arr[] = {
-  hi_hat_break_standard,
-  hi_hat_rhythm_4_4_eights,
-  empty_rhythm
-};
-RhythmCollection hi_hat_rock_breaks = {
-  hi_hat_rock_breaks_arr, 3, 0
+const Rhythm* const hi_hat_rock_breaks_arr[] PROGMEM = {
+  &hi_hat_break_standard,
+  &hi_hat_rhythm_4_4_eights,
+  &empty_rhythm
 };
 
 // Blues breaks
-r_func hi_hat_blues_breaks_arr[] = {
-  empty_rhythm,
-  hi_hat_break_standard,
-  hi_hat_rhythm_4_4_offbeat,
-  hi_hat_rhythm_triplets_1_3,
-  hi_hat_rhythm_4_4_triplets
-};
-RhythmCollection hi_hat_blues_breaks = {
-  hi_hat_blues_breaks_arr, 5, 0
+const Rhythm* const hi_hat_blues_breaks_arr[] PROGMEM = {
+  &empty_rhythm,
+  &hi_hat_break_standard,
+  &hi_hat_rhythm_4_4_offbeat,
+  &hi_hat_rhythm_triplets_1_3,
+  &hi_hat_rhythm_4_4_triplets
 };
 
 // Jazz breaks
-r_func hi_hat_jazz_breaks_arr[] = {
-  empty_rhythm,
-  hi_hat_break_standard,
-  hi_hat_rhythm_4_4_offbeat,
-  hi_hat_rhythm_triplets_1_3,
-  hi_hat_rhythm_4_4_triplets
-};
-RhythmCollection hi_hat_jazz_breaks = {
-  hi_hat_jazz_breaks_arr, 5, 0
+const Rhythm* const hi_hat_jazz_breaks_arr[] PROGMEM = {
+  &empty_rhythm,
+  &hi_hat_break_standard,
+  &hi_hat_rhythm_4_4_offbeat,
+  &hi_hat_rhythm_triplets_1_3,
+  &hi_hat_rhythm_4_4_triplets
 };
 
 // Waltz breaks
-r_func hi_hat_waltz_breaks_arr[] = {
-  empty_rhythm,
-  hi_hat_rhythm_3_4_triplets
-};
-RhythmCollection hi_hat_waltz_breaks = {
-  hi_hat_waltz_breaks_arr, 2, 0
+const Rhythm* const hi_hat_waltz_breaks_arr[] PROGMEM = {
+  &empty_rhythm,
+  &hi_hat_rhythm_3_4_triplets
 };
 
-RhythmCollection hi_hat_breaks[] = {
-  hi_hat_standard_breaks,
-  hi_hat_rock_breaks,
-  hi_hat_blues_breaks,
-  hi_hat_jazz_breaks,
-  hi_hat_waltz_breaks
+const RhythmCollection hi_hat_breaks[mode_count] PROGMEM = {
+  {hi_hat_standard_breaks_arr, 3},
+  {hi_hat_rock_breaks_arr, 3},
+  {hi_hat_blues_breaks_arr, 5},
+  {hi_hat_jazz_breaks_arr, 5},
+  {hi_hat_waltz_breaks_arr, 2}
 };
 
-unsigned char hi_hat_cur_rhythm_notes[RHYTHM_MAX_NOTES] = {0};
-Rhythm hi_hat_cur_rhythm = {
-  "", 4, 4, 1, hi_hat_cur_rhythm_notes, 0
-};
-unsigned char hi_hat_cur_break_notes[RHYTHM_MAX_NOTES] = {0};
-Rhythm hi_hat_cur_break = {
-  "", 4, 4, 1, hi_hat_cur_break_notes, 0
-};
-Instrument hi_hat = {
-  2, "Hi-Hat", 42, A2, hi_hat_rhythms, hi_hat_breaks,
-  hi_hat_cur_rhythm, hi_hat_cur_break
-};
 
 /* Splash */
 /* Splash rhythms */
 
-// No splash rhythms yet
-RhythmCollection* splash_rhythms = empty_rhythms;
+// No splash rhythms yet, it uses empty_rhythms
 
 /* Splash breaks */
-void splash_break_eigth(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x50
-  };
-  strcpy(r->name, "8");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 8;
-  r->note_count = 8;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
-void splash_break_4_4(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x00, 0x00, 0x00, 0x50
-  };
-  strcpy(r->name, "4");
-  r->numerator = 4;
-  r->denominator = 4;
-  r->subdivision = 4;
-  r->note_count = 4;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
+const unsigned char splash_break_eigth_notes[] PROGMEM = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x50
+};
+const Rhythm splash_break_eigth PROGMEM = {
+  "8", 4, 4, 8, 8, splash_break_eigth_notes
+};
+const unsigned char splash_break_4_4_notes[] PROGMEM = {
+  0x00, 0x00, 0x00, 0x50
+};
+const Rhythm splash_break_4_4 PROGMEM = {
+  "4", 4, 4, 4, 4, splash_break_4_4_notes
+};
 
 // 3/4
-void splash_break_3_4(Rhythm* r) {
-  const unsigned char notes[] = {
-    0x00, 0x00, 0x50
-  };
-  strcpy(r->name, "4");
-  r->numerator = 3;
-  r->denominator = 4;
-  r->subdivision = 4;
-  r->note_count = 3;
-  for (int n=0;n < r->note_count;n++) {
-    r->notes[n] = notes[n];
-  }
-}
+const unsigned char splash_break_3_4_notes[] PROGMEM = {
+  0x00, 0x00, 0x50
+};
+const Rhythm splash_break_3_4 PROGMEM = {
+  "4", 3, 4, 4, 3, splash_break_3_4_notes
+};
 
 // Standard breaks
-r_func splash_standard_breaks_arr[] = {splash_break_eigth};
-RhythmCollection splash_standard_breaks = {
-  splash_standard_breaks_arr, 1, 0
+const Rhythm* const splash_standard_breaks_arr[] PROGMEM = {
+  &splash_break_eigth
 };
 
 // Rock breaks
-r_func splash_rock_breaks_arr[] = {splash_break_4_4};
-RhythmCollection splash_rock_breaks = {
-  splash_rock_breaks_arr, 1, 0
-};
+const Rhythm* const splash_rock_breaks_arr[] PROGMEM = {&splash_break_4_4};
 
 // Blues breaks
-r_func splash_blues_breaks_arr[] = {splash_break_4_4};
-RhythmCollection splash_blues_breaks = {
-  splash_blues_breaks_arr, 1, 0
-};
+const Rhythm* const splash_blues_breaks_arr[] PROGMEM = {&splash_break_4_4};
 
 // Jazz breaks
-r_func splash_jazz_breaks_arr[] = {splash_break_4_4};
-RhythmCollection splash_jazz_breaks = {
-  splash_jazz_breaks_arr, 1, 0
-};
+const Rhythm* const splash_jazz_breaks_arr[] PROGMEM = {&splash_break_4_4};
 
 // Waltz breaks
-r_func splash_waltz_breaks_arr[] = {splash_break_3_4};
-RhythmCollection splash_waltz_breaks = {
-  splash_waltz_breaks_arr, 1, 0
-};
-
-RhythmCollection splash_breaks[] = {
-  splash_standard_breaks,
-  splash_rock_breaks,
-  splash_blues_breaks,
-  splash_jazz_breaks,
-  splash_waltz_breaks
-};
+const Rhythm* const splash_waltz_breaks_arr[] PROGMEM = {&splash_break_3_4};
 
-unsigned char splash_cur_rhythm_notes[RHYTHM_MAX_NOTES] = {0};
-Rhythm splash_cur_rhythm = {
-  "", 4, 4, 1, splash_cur_rhythm_notes, 1
-};
-unsigned char splash_cur_break_notes[RHYTHM_MAX_NOTES] = {0};
-Rhythm splash_cur_break = {
-  "", 4, 4, 1, splash_cur_break_notes, 1
-};
-Instrument splash = {
-  3, "Splash", 49, A2, splash_rhythms, splash_breaks,
-  splash_cur_rhythm, splash_cur_break
+const RhythmCollection splash_breaks[mode_count] PROGMEM = {
+  {splash_standard_breaks_arr, 1},
+  {splash_rock_breaks_arr, 1},
+  {splash_blues_breaks_arr, 1},
+  {splash_jazz_breaks_arr, 1},
+  {splash_waltz_breaks_arr, 1}
 };
 
 
@@ -902,143 +960,240 @@ Instrument splash = {
 // take the ones of hi-hat
 
 // Standard rhythms
-r_func ride_standard_rhythms_arr[] = {
-  empty_rhythm,
-  hi_hat_rhythm_4_4_eights,
-  hi_hat_rhythm_4_4_offbeat
-};
-RhythmCollection ride_standard_rhythms = {
-  ride_standard_rhythms_arr, 3, 0
+const Rhythm* const ride_standard_rhythms_arr[] PROGMEM = {
+  &empty_rhythm,
+  &hi_hat_rhythm_4_4_eights,
+  &hi_hat_rhythm_4_4_offbeat
 };
 
 // Rock rhythms
-r_func ride_rock_rhythms_arr[] = {
-  empty_rhythm,
-  hi_hat_rhythm_4_4_eights,
-  hi_hat_rhythm_4_4_offbeat
-};
-RhythmCollection ride_rock_rhythms = {
-  ride_rock_rhythms_arr, 3, 0
+const Rhythm* const ride_rock_rhythms_arr[] PROGMEM = {
+  &empty_rhythm,
+  &hi_hat_rhythm_4_4_eights,
+  &hi_hat_rhythm_4_4_offbeat
 };
 
 // Blues rhythms
-r_func ride_blues_rhythms_arr[] = {
-  hi_hat_rhythm_4_4_triplets,
-  hi_hat_rhythm_triplets_1_3,
-  empty_rhythm
-};
-RhythmCollection ride_blues_rhythms = {
-  ride_blues_rhythms_arr, 3, 0
+const Rhythm* const ride_blues_rhythms_arr[] PROGMEM = {
+  &hi_hat_rhythm_4_4_triplets,
+  &hi_hat_rhythm_triplets_1_3,
+  &empty_rhythm
 };
 
 // Jazz rhythms
-r_func ride_jazz_rhythms_arr[] = {
-  hi_hat_rhythm_4_4_offbeat,
-  hi_hat_rhythm_triplets_1_3,
-  hi_hat_rhythm_4_4_triplets,
-  empty_rhythm
-};
-RhythmCollection ride_jazz_rhythms = {
-  ride_jazz_rhythms_arr, 4, 0
+const Rhythm* const ride_jazz_rhythms_arr[] PROGMEM = {
+  &hi_hat_rhythm_4_4_offbeat,
+  &hi_hat_rhythm_triplets_1_3,
+  &hi_hat_rhythm_4_4_triplets,
+  &empty_rhythm
 };
 
 // Waltz rhythms
-r_func ride_waltz_rhythms_arr[] = {
-  hi_hat_rhythm_3_4_waltz,
-  hi_hat_rhythm_3_4_triplets,
-  empty_rhythm
-};
-RhythmCollection ride_waltz_rhythms = {
-  ride_waltz_rhythms_arr, 3, 0
+const Rhythm* const ride_waltz_rhythms_arr[] PROGMEM = {
+  &hi_hat_rhythm_3_4_waltz,
+  &hi_hat_rhythm_3_4_triplets,
+  &empty_rhythm
 };
 
-RhythmCollection ride_rhythms[] = {
-  ride_standard_rhythms,
-  ride_rock_rhythms,
-  ride_blues_rhythms,
-  ride_jazz_rhythms,
-  ride_waltz_rhythms
+const RhythmCollection ride_rhythms[mode_count] PROGMEM = {
+  {ride_standard_rhythms_arr, 3},
+  {ride_rock_rhythms_arr, 3},
+  {ride_blues_rhythms_arr, 3},
+  {ride_jazz_rhythms_arr, 4},
+  {ride_waltz_rhythms_arr, 3}
 };
 
 /* Ride breaks */
-r_func ride_break_standard = hi_hat_break_standard;
+// same standard break as the hi-hat
 
 // Standard breaks
-r_func ride_standard_breaks_arr[] = {
-  empty_rhythm,
-  ride_break_standard,
-  hi_hat_rhythm_4_4_eights
-};
-RhythmCollection ride_standard_breaks = {
-  ride_standard_breaks_arr, 3, 0
+const Rhythm* const ride_standard_breaks_arr[] PROGMEM = {
+  &empty_rhythm,
+  &hi_hat_break_standard,
+  &hi_hat_rhythm_4_4_eights
 };
 
 // Rock breaks
-r_func ride_rock_breaks_arr[] = {
-  empty_rhythm,
-  ride_break_standard,
-  hi_hat_rhythm_4_4_eights
-};
-RhythmCollection ride_rock_breaks = {
-  ride_rock_breaks_arr, 3, 0
+const Rhythm* const ride_rock_breaks_arr[] PROGMEM = {
+  &empty_rhythm,
+  &hi_hat_break_standard,
+  &hi_hat_rhythm_4_4_eights
 };
 
 // Blues breaks
-r_func ride_blues_breaks_arr[] = {
-  empty_rhythm,
-  ride_break_standard,
-  hi_hat_rhythm_4_4_offbeat,
-  hi_hat_rhythm_triplets_1_3,
-  hi_hat_rhythm_4_4_triplets
-};
-RhythmCollection ride_blues_breaks = {
-  ride_blues_breaks_arr, 5, 0
+const Rhythm* const ride_blues_breaks_arr[] PROGMEM = {
+  &empty_rhythm,
+  &hi_hat_break_standard,
+  &hi_hat_rhythm_4_4_offbeat,
+  &hi_hat_rhythm_triplets_1_3,
+  &hi_hat_rhythm_4_4_triplets
 };
 
 // Jazz breaks
-r_func ride_jazz_breaks_arr[] = {
-  empty_rhythm,
-  ride_break_standard,
-  hi_hat_rhythm_4_4_offbeat,
-  hi_hat_rhythm_triplets_1_3,
-  hi_hat_rhythm_4_4_triplets
-};
-RhythmCollection ride_jazz_breaks = {
-  ride_jazz_breaks_arr, 5, 0
+const Rhythm* const ride_jazz_breaks_arr[] PROGMEM = {
+  &empty_rhythm,
+  &hi_hat_break_standard,
+  &hi_hat_rhythm_4_4_offbeat,
+  &hi_hat_rhythm_triplets_1_3,
+  &hi_hat_rhythm_4_4_triplets
 };
 
 // Waltz breaks
-r_func ride_waltz_breaks_arr[] = {
-  empty_rhythm,
-  hi_hat_rhythm_3_4_triplets
+const Rhythm* const ride_waltz_breaks_arr[] PROGMEM = {
+  &empty_rhythm,
+  &hi_hat_rhythm_3_4_triplets
 };
-RhythmCollection ride_waltz_breaks = {
-  ride_waltz_breaks_arr, 2, 0
+
+const RhythmCollection ride_breaks[mode_count] PROGMEM = {
+  {ride_standard_breaks_arr, 3},
+  {ride_rock_breaks_arr, 3},
+  {ride_blues_breaks_arr, 5},
+  {ride_jazz_breaks_arr, 5},
+  {ride_waltz_breaks_arr, 2}
 };
 
-RhythmCollection ride_breaks[] = {
-  ride_standard_breaks,
-  ride_rock_breaks,
-  ride_blues_breaks,
-  ride_jazz_breaks,
-  ride_waltz_breaks
+
+/* Instrument list */
+const Instrument instrs[instrument_count] PROGMEM = {
+  {"Bass Drum", 36, A4, 24, 100, 4, 0, FILL_KEEP,
+   bass_rhythms, bass_breaks},
+  {"Snare Drum", 38, A1, 24, 100, 8, 1, FILL_ROLL,
+   snare_rhythms, snare_breaks},
+  {"Hi-Hat", 42, A2, 12, 97, 14, 1, FILL_DENSER,
+   hi_hat_rhythms, hi_hat_breaks},
+  {"Splash", 49, A2, 48, 100, 6, 0, FILL_CRASH,
+   empty_rhythms, splash_breaks},
+  {"Ride", 51, A2, 48, 97, 12, 1, FILL_DENSER, ride_rhythms, ride_breaks}
+};
+
+/* Grooves */
+const int groove_count = 4;
+const Groove grooves[groove_count] PROGMEM = {
+  {
+    "Straight",
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {128, 128, 128, 128, 128, 128, 128, 128,
+     128, 128, 128, 128, 128, 128, 128, 128}
+  },
+  {
+    // backbeat on 2 and 4 a little late
+    "Laid Back",
+    {0, 0, 1, 0, 3, 0, 1, 0, 0, 0, 1, 0, 3, 0, 1, 0},
+    {128, 128, 128, 128, 136, 128, 128, 128,
+     128, 128, 128, 128, 136, 128, 128, 128}
+  },
+  {
+    // sixteenths between the eighths early and soft
+    "Push",
+    {0, -2, 0, -2, 0, -2, 0, -2, 0, -2, 0, -2, 0, -2, 0, -2},
+    {136, 104, 120, 104, 136, 104, 120, 104,
+     136, 104, 120, 104, 136, 104, 120, 104}
+  },
+  {
+    // strong downbeats, ghosted offbeats
+    "Accents",
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {150, 80, 110, 80, 140, 80, 110, 80,
+     145, 80, 110, 80, 140, 80, 110, 80}
+  }
 };
 
-unsigned char ride_cur_rhythm_notes[RHYTHM_MAX_NOTES] = {0};
-Rhythm ride_cur_rhythm = {
-  "", 4, 4, 1, ride_cur_rhythm_notes, 0
+/* Velocity curves */
+const int curve_count = 4;
+const VelocityCurve velocity_curves[curve_count] PROGMEM = {
+  {
+    "Linear",
+    {
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+      12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23,
+      24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,
+      36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+      48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59,
+      60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71,
+      72, 73, 74, 75, 76, 77, 78, 79, 80, 81, 82, 83,
+      84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95,
+      96, 97, 98, 99, 100, 101, 102, 103, 104, 105, 106, 107,
+      108, 109, 110, 111, 112, 113, 114, 115, 116, 117, 118, 119,
+      120, 121, 122, 123, 124, 125, 126, 127
+    }
+  },
+  {
+    "Soft",
+    {
+      0, 5, 10, 14, 18, 21, 25, 28, 30, 33, 36, 38,
+      40, 43, 45, 47, 49, 50, 52, 54, 56, 57, 59, 60,
+      62, 63, 64, 66, 67, 68, 69, 71, 72, 73, 74, 75,
+      76, 77, 78, 79, 80, 81, 82, 83, 84, 84, 85, 86,
+      87, 88, 89, 89, 90, 91, 92, 92, 93, 94, 94, 95,
+      96, 96, 97, 98, 98, 99, 100, 100, 101, 101, 102, 103,
+      103, 104, 104, 105, 105, 106, 106, 107, 107, 108, 109, 109,
+      110, 110, 110, 111, 111, 112, 112, 113, 113, 114, 114, 115,
+      115, 116, 116, 116, 117, 117, 118, 118, 118, 119, 119, 120,
+      120, 120, 121, 121, 122, 122, 122, 123, 123, 123, 124, 124,
+      125, 125, 125, 126, 126, 126, 127, 127
+    }
+  },
+  {
+    "Hard",
+    {
+      0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2,
+      2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5,
+      5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9,
+      9, 9, 10, 10, 10, 11, 11, 12, 12, 13, 13, 14,
+      14, 15, 15, 16, 16, 17, 17, 18, 18, 19, 20, 20,
+      21, 21, 22, 23, 24, 24, 25, 26, 27, 27, 28, 29,
+      30, 31, 32, 32, 33, 34, 35, 36, 37, 38, 40, 41,
+      42, 43, 44, 45, 47, 48, 49, 50, 52, 53, 55, 56,
+      58, 59, 61, 62, 64, 66, 67, 69, 71, 73, 75, 77,
+      79, 81, 83, 85, 87, 89, 92, 94, 96, 99, 101, 104,
+      107, 109, 112, 115, 118, 121, 124, 127
+    }
+  },
+  {
+    "Accents",
+    {
+      0, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 6,
+      6, 7, 8, 8, 9, 10, 11, 12, 12, 13, 14, 15,
+      16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 28,
+      29, 30, 31, 32, 33, 35, 36, 37, 38, 39, 41, 42,
+      43, 45, 46, 47, 48, 50, 51, 52, 54, 55, 56, 58,
+      59, 60, 62, 63, 64, 65, 67, 68, 69, 71, 72, 73,
+      75, 76, 77, 79, 80, 81, 82, 84, 85, 86, 88, 89,
+      90, 91, 92, 94, 95, 96, 97, 98, 99, 101, 102, 103,
+      104, 105, 106, 107, 108, 109, 110, 111, 112, 113, 114, 115,
+      115, 116, 117, 118, 119, 119, 120, 121, 121, 122, 123, 123,
+      124, 124, 125, 125, 126, 126, 127, 127
+    }
+  }
 };
-unsigned char ride_cur_break_notes[RHYTHM_MAX_NOTES] = {0};
-Rhythm ride_cur_break = {
-  "", 4, 4, 1, ride_cur_break_notes, 0
+
+/* Songs: modes, rhythm numbers and bar counts, the breaks are the
+   selected ones of the mode */
+const SongEntry rock_song_entries[] PROGMEM = {
+  // mode, {bass, snare, hi-hat, splash, ride}, break, bars
+  {0, {0, 0, 0, 0, 0}, 0, 2},
+  {1, {1, 0, 1, 0, 0}, 0, 8},
+  {1, {1, 1, 1, 0, 0}, 1, 1},
+  {1, {2, 1, 2, 0, 1}, 0, 8},
+  {1, {0, 0, 0, 0, 0}, 1, 1}
 };
-Instrument ride = {
-  4, "Ride", 51, A2, ride_rhythms, ride_breaks,
-  ride_cur_rhythm, ride_cur_break
+
+const SongEntry blues_song_entries[] PROGMEM = {
+  {2, {0, 0, 0, 0, 0}, 0, 12},
+  {2, {1, 0, 1, 0, 2}, 0, 12},
+  {2, {0, 0, 0, 0, 0}, 1, 1}
 };
 
+const SongEntry waltz_song_entries[] PROGMEM = {
+  {4, {0, 0, 0, 0, 0}, 0, 8},
+  {4, {0, 1, 1, 0, 2}, 0, 8},
+  {4, {0, 0, 0, 0, 0}, 1, 1}
+};
 
-/* Instrument list */
-Instrument instrs[] = {bass_drum, snare_drum, hi_hat, splash, ride};
-const int instrument_count = 5;
+const int song_count = 3;
+const Song songs[song_count] PROGMEM = {
+  {"Rock Song", rock_song_entries, 5},
+  {"Blues Song", blues_song_entries, 3},
+  {"Waltz Song", waltz_song_entries, 3}
+};
 #endif
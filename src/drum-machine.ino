@@ -19,16 +19,100 @@
 #include "drum-machine.h"
 #include <LiquidCrystal.h>
 #include <EEPROM.h>
+#include <avr/eeprom.h>
 
-// Patch EEPROM
-void EEPROM_update(int pos, int data) {
-  if (EEPROM.read(pos) != data) {
-    EEPROM.write(pos, data);
+// LCD display
+LiquidCrystal lcd_device(7, 8, 9, 10, 11, 12);
+
+const int LCD_COLS = 16;
+const int LCD_ROWS = 2;
+// characters sent to the display per loop() pass
+const int LCD_CELLS_PER_PASS = 4;
+
+class LcdBuffer: public Print {
+  /*
+   * Shadow of the display. Views draw into it without waiting for the
+   * LCD, refresh() sends the changed cells a few at a time.
+   */
+public:
+  LcdBuffer(LiquidCrystal& device): device(device) {}
+
+  void begin() {
+    device.begin(LCD_COLS, LCD_ROWS);
+    device.clear();
+    memset(shown, ' ', sizeof(shown));
+    device_col = device_row = 0;
+    clear();
   }
-}
 
-// LCD display
-LiquidCrystal lcd(7, 8, 9, 10, 11, 12);
+  void clear() {
+    for (int r=0;r<LCD_ROWS;r++) {
+      for (int c=0;c<LCD_COLS;c++) {
+        setCell(r, c, ' ');
+      }
+    }
+    home();
+  }
+
+  void home() {
+    col = row = 0;
+  }
+
+  void setCursor(uint8_t c, uint8_t r) {
+    col = c;
+    row = r < LCD_ROWS ? r : LCD_ROWS - 1;
+  }
+
+  size_t write(uint8_t ch) {
+    if (col < LCD_COLS) {
+      setCell(row, col, ch);
+    }
+    col++;
+    return 1;
+  }
+  using Print::write;
+
+  void refresh(int max_cells) {
+    /* Send up to max_cells changed cells to the LCD */
+    for (int r=0;r<LCD_ROWS && max_cells > 0;r++) {
+      for (int c=0;c<LCD_COLS && max_cells > 0 && dirty[r];c++) {
+        if (!(dirty[r] & (1 << c))) {
+          continue;
+        }
+        // the LCD moves its cursor on by itself after every character
+        if (c != device_col || r != device_row) {
+          device.setCursor(c, r);
+        }
+        device.write(cells[r][c]);
+        device_col = c + 1;
+        device_row = r;
+        shown[r][c] = cells[r][c];
+        dirty[r] &= ~(1 << c);
+        max_cells--;
+      }
+    }
+  }
+
+private:
+  void setCell(int r, int c, char ch) {
+    cells[r][c] = ch;
+    if (ch != shown[r][c]) {
+      dirty[r] |= 1 << c;
+    }
+    else {
+      dirty[r] &= ~(1 << c);
+    }
+  }
+
+  LiquidCrystal& device;
+  char cells[LCD_ROWS][LCD_COLS]; // wanted content
+  char shown[LCD_ROWS][LCD_COLS]; // content of the LCD
+  unsigned int dirty[LCD_ROWS]; // one bit per column, cells != shown
+  uint8_t col;
+  uint8_t row;
+  uint8_t device_col;
+  uint8_t device_row;
+} lcd(lcd_device);
 
 // Pin to display beat
 const int metronome_pin = 13;
@@ -46,11 +130,29 @@ const char break_pin = 22;
 // mute switche
 const char mute_switch_pin = 23;
 
+// The buttons above as port bits of the Arduino Mega, read directly by
+// sampleButtons(): up PE4, down PE5, left PG5, right PE3, enter PH3,
+// break PA0, mute PA1
+
 // MIDI commands
+const unsigned char NOTE_OFF = 0x80;
 const unsigned char NOTE_ON = 0x90;
 const unsigned char CONTROL_CHANGE = 0xB0;
 const unsigned char PROGRAM_CHANGE = 0xC0;
 const unsigned char PITCH_BEND_CHANGE = 0xE0;
+const unsigned char SYSTEM_EXCLUSIVE = 0xF0;
+const unsigned char SONG_POSITION = 0xF2;
+const unsigned char END_OF_EXCLUSIVE = 0xF7;
+const unsigned char TIMING_CLOCK = 0xF8;
+const unsigned char START = 0xFA;
+const unsigned char CONTINUE = 0xFB;
+const unsigned char STOP = 0xFC;
+
+// MIDI input on drum_channel: Program Change selects the mode, these
+// controllers plus the instrument number select a rhythm or break by its
+// index, from the next bar on
+const unsigned char CC_RHYTHM = 102;
+const unsigned char CC_BREAK = 110;
 
 
 // Styles
@@ -61,7 +163,15 @@ enum class Mode : int {
   JAZZ,
   WALTZ
 };
-const unsigned char mode_count = 5;
+// swing and groove of every mode, applied when the rhythms are compiled.
+// Saved; until the settings are restored it holds the defaults.
+ModeFeel mode_feels[mode_count] = {
+  {50, 0}, // Standard
+  {50, 0}, // Rock
+  {67, 0}, // Blues: swung eighths on the triplet grid
+  {67, 0}, // Jazz
+  {50, 0}  // Waltz
+};
 const char mode_names[mode_count][17] = {
   "Standard", "Rock", "Blues", "Jazz", "Waltz"
 };
@@ -69,20 +179,13 @@ boolean mode_break_mute[] = {
   true, true, true, true, true
 };
 
-// last joystick input
-boolean last_up;
-boolean last_down;
-boolean last_left;
-boolean last_right;
-boolean last_enter;
-
 // break input variables
-boolean last_break = false;
-boolean is_break = false;
+volatile boolean is_break = false;
+// break of the playing song entry
+volatile boolean song_break = false;
 
 // mute input variables
-boolean muted = false;
-boolean last_muted = false;
+volatile boolean muted = false;
 
 // beats per minute
 int last_bpm = 0;
@@ -104,30 +207,220 @@ const int vol_pin = A8;
 
 unsigned char drum_channel = 9;
 
-// subdivision of one bar
+// ticks per quarter note
 const int subdivision = 96;
-int max_bars = 96;
-
-long step_counter;
-
-int mode = (int) Mode::STD;
-
-int numerator = 4;
-int denominator = 4;
+// The step counter wraps after this many ticks: a multiple of 8 bars of
+// every time signature of up to 12 beats (halves, quarters, eighths...),
+// so the bars and the phrases of the fills go on over a wrap
+const long wrap_ticks = (long) subdivision * 4 * 4 * 27720;
+
+// written by the step timer interrupt, read it with getStepCounter()
+volatile long step_counter;
+
+// MIDI clock: 24 clocks per quarter note, Song Position counts sixteenths
+const int clock_ticks = subdivision / 24;
+const int position_ticks = subdivision / 4;
+const long position_count = 16384; // 14 bits, sent modulo that
+enum ClockState {
+  CLOCK_STOPPED,
+  CLOCK_POSITION, // send Song Position at the next sixteenth
+  CLOCK_CONTINUE, // send Start or Continue at the next sixteenth
+  CLOCK_RUNNING
+};
+volatile ClockState clock_state = CLOCK_STOPPED;
+
+// Step timer
+// Timer1 counts at F_CPU / 64 (4 us at 16 MHz). One tick lasts
+// tick_counts / (bpm * subdivision) timer counts. The integer part is
+// programmed into OCR1A, the remainder is accumulated and spread over the
+// ticks, so the tempo is exact on average and never drifts.
+const unsigned long tick_counts = F_CPU / 64 * 60;
+volatile unsigned int tick_period;
+volatile unsigned int tick_remainder;
+volatile unsigned int tick_divisor;
+unsigned int tick_accumulator = 0;
+
+// Clock slave. Incoming clocks (0xF8) drive the ticks as soon as they
+// arrive. A phase locked loop sets the tick length from the smoothed
+// clock period and pulls it towards the phase of the clock. Every clock
+// allows clock_ticks more ticks, so the ticks never run ahead of it.
+volatile boolean slave = false;
+volatile boolean ext_running = true; // Stop halts, Start/Continue go on
+volatile boolean ext_starting = false; // go on with the next clock
+volatile unsigned long slave_last_clock; // micros()
+boolean slave_clocked = false; // slave_last_clock is a clock
+volatile unsigned int slave_clock_period = 0; // timer counts, 0 = unknown
+volatile unsigned int slave_period; // tick length, timer counts
+volatile int slave_budget = 0; // ticks left until the next clock
+boolean slave_waiting = false; // the tick of the next clock is due
+// back to the internal clock after this long without a clock
+const unsigned long slave_timeout = 500000; // us
+
+// background work done in loop(), one slice per pass
+int loop_slice = 0;
+
+// both changed by the step interrupt when a song entry starts
+volatile int mode = (int) Mode::STD;
+
+// Meter: the time signature of the lead rhythm, the first one with notes
+// in instrument order. The other rhythms loop on their own time
+// signature against it. Bars and beats count from bar_start, the step the
+// meter last changed on.
+volatile unsigned int bar_ticks = 4 * subdivision;
+volatile unsigned int beat_ticks = subdivision;
+volatile unsigned char bar_beats = 4;
+volatile long bar_start = 0;
 
 // EEPROM addresses
+const int settings_pos = 0; // SETTINGS_SLOT_COUNT slots
+const int pattern_store_pos = 1024; // up to the end of the EEPROM
+// legacy layout, in the settings log now
 const int mode_pos = 0;
 const int instruments_pos = 256;
 
-// last status byte to implement MIDI running status
-unsigned char last_status_byte = 0;
-
-// Used to access data from a r_func only needed one time
-unsigned char tmp_rhythm_notes[RHYTHM_MAX_NOTES] = {0};
-Rhythm tmp_rhythm = {
-  "", 4, 4, 1, tmp_rhythm_notes, 0
+// Settings. Changes go to the RAM shadow and are written behind once
+// nothing changed for SETTINGS_QUIET_MS, one byte per pass of loop().
+Settings settings;
+boolean settings_dirty = false;
+unsigned long settings_changed; // millis() of the last change
+int settings_slot; // newest valid record
+unsigned char settings_seq; // its sequence number
+int settings_write_pos = -1; // next byte of the record written, -1 = none
+int settings_write_slot;
+uint16_t settings_crc;
+
+// Instrument, layer and mode (getPatternKey) of the user pattern in every
+// slot of the pattern store, NO_PATTERN for empty slots
+unsigned char pattern_keys[PATTERN_SLOT_COUNT];
+
+// SysEx transfers of user patterns, one at a time. An upload collects
+// the pattern in pattern_image and writes it to its slot one byte per
+// pass of loop(), never waiting for the EEPROM. A dump sends a message
+// per pass as long as the output queue stays half empty for the notes.
+enum PatternTransfer {
+  TRANSFER_IDLE,
+  TRANSFER_RECEIVING,
+  TRANSFER_WRITING,
+  TRANSFER_DUMPING
+};
+PatternTransfer transfer_state = TRANSFER_IDLE;
+int transfer_port;
+int transfer_slot;
+int transfer_length; // bytes of pattern_image to write or send
+int transfer_pos; // bytes written or sent, -1 = dump not begun
+boolean transfer_error; // a data message got lost
+boolean dump_all; // dump the following slots too
+unsigned char pattern_image[PATTERN_SLOT_SIZE];
+
+// MIDI output ports. The UARTs are driven directly, Serial and Serial1
+// must not be used: the core's HardwareSerial brings its own interrupt
+// handlers for them.
+const int MIDI_USB = 0; // TX0, USB
+const int MIDI_DIN = 1; // TX1, pin 18
+MidiPort midi_ports[MIDI_PORT_COUNT];
+MidiParser midi_parsers[MIDI_PORT_COUNT];
+// channel messages received for loop()
+MidiMessage midi_in[MIDI_IN_QUEUE_SIZE];
+volatile unsigned char midi_in_head = 0;
+volatile unsigned char midi_in_tail = 0;
+
+// Note on latency of the DIN port, measured per instrument
+LatencyStats latency_stats[instrument_count];
+LatencyMark latency_marks[LATENCY_MARK_COUNT];
+volatile unsigned char latency_marks_head = 0;
+volatile unsigned char latency_marks_tail = 0;
+
+// Selected rhythms and breaks of every instrument
+InstrumentState instr_states[instrument_count];
+
+// Hot state of every instrument, the only instrument data the step
+// interrupt touches
+Voice voices[instrument_count];
+
+// Song player. The next entry is compiled into the standby schedules
+// while the one before plays, the step interrupt swaps them in when the
+// step counter reaches swap_step, or at once when the counter jumps.
+int cur_song = 0;
+boolean song_playing = false;
+int song_entry; // entry prepared or playing
+int song_current = -1; // entry playing, -1 before the first
+int song_saved_mode; // mode before the song
+volatile long swap_step = -1; // -1 = nothing to swap
+volatile unsigned char swap_wraps = 0; // step counter wraps before swap_step
+volatile unsigned char swap_mode;
+volatile boolean swap_break;
+volatile long last_swap_step; // step of the last swap
+
+// Fills. With fill_bars set, the last bar of every phrase of fill_bars
+// bars plays a variation of the rhythms (see FillRole). The fill is built
+// into the standby break schedules during the bar before, one instrument
+// per pass of loop(), and the step interrupt swaps it with the breaks for
+// one bar. Not while a song plays, it needs the standby schedules.
+enum FillState {
+  FILL_IDLE,
+  FILL_BUILDING,
+  FILL_ARMED, // built, starts at fill_step
+  FILL_PLAYING // ends at fill_step
+};
+int fill_bars = 0; // 0 = no fills
+volatile FillState fill_state = FILL_IDLE;
+int fill_instr; // instrument built next
+long fill_start; // first step of the fill bar, from bar_start
+volatile long fill_step = -1; // step of the next fill swap
+const unsigned char fill_crash_velocity = 110;
+
+// Quantized changes. A newly selected rhythm or break is compiled into
+// the cue schedule of its voice in loop(), the step interrupt swaps it in
+// at cue_step, the next boundary of the quantize setting. The break
+// switch takes over there as well.
+volatile long cue_step = -1; // -1 = nothing cued
+volatile boolean break_cued = false;
+volatile boolean cued_break; // is_break from cue_step on
+
+// Powers of ten for escapeLCDNum()
+const int DECIMAL_DIGITS = 5;
+const unsigned int decimal_places[DECIMAL_DIGITS] = {
+  1, 10, 100, 1000, 10000
 };
 
+// Timing wheel of note offs, indexed by wheel_tick
+unsigned char note_wheel[NOTE_WHEEL_SIZE];
+// the same for note ons humanize plays late
+unsigned char delay_wheel[NOTE_WHEEL_SIZE];
+
+// Humanize: random probability, velocity and timing of the notes. The
+// generator is seeded with humanize_seed at power up and on Start, so
+// the same seed always plays the same. Both are saved, off by default.
+const uint16_t default_seed = 0x2f6b;
+boolean humanize = false;
+uint16_t humanize_seed = default_seed;
+uint16_t random_state;
+unsigned char wheel_tick = 0;
+
+// Background ADC scanner. All pots are converted one after the other by
+// the ADC interrupt, nobody waits for analogRead().
+unsigned char pot_channels[POT_MAX_COUNT]; // ADC channel of every pot
+unsigned char pot_count = 0;
+unsigned char pot_cur = 0; // pot being converted
+volatile unsigned int pot_filtered[POT_MAX_COUNT]; // 4 * smoothed reading
+volatile unsigned char pot_levels[POT_MAX_COUNT]; // smoothed, 7 bit
+volatile unsigned char pot_rounds = 0; // full scans, stops at 255
+unsigned char bpm_pot;
+unsigned char pitch_pot;
+unsigned char vol_pot;
+
+// Button scanner: the Timer0 compare interrupt samples all buttons about
+// once a millisecond and debounces them with vertical counters, a two bit
+// counter per button spread over two bytes. A button takes a new state
+// after four samples in a row that differ from the old one. The changes
+// are queued as events for loop().
+unsigned char button_count0 = 0xff; // bit 0 of the counters
+unsigned char button_count1 = 0xff; // bit 1
+volatile unsigned char button_state = 0; // debounced, 1 = pressed
+unsigned char button_events[BUTTON_QUEUE_SIZE]; // Button | BUTTON_PRESSED
+volatile unsigned char button_head = 0; // next event to handle
+volatile unsigned char button_tail = 0; // next free slot
+
 // SCREENS
 class MainView: public View {
   void updateDisplay() {
@@ -142,8 +435,11 @@ class MainView: public View {
     lcd.setCursor(0, 1);
     lcd.print("BPM: ");
     escapeLCDNum(bpm, 3);
+    if (slave) {
+      lcd.print(" ext");
+    }
 
-    displayBeat(step_counter, true);
+    displayBeat(getStepCounter(), true);
   }
 
   void computeUp() {
@@ -184,36 +480,24 @@ class SetRhythmView: public View {
     lcd.home();
     // write mode name
     lcd.print("Rhythm ");
-    lcd.print(instrs[cur_instr].name);
+    lcd.print((const __FlashStringHelper*) instrs[cur_instr].name);
     lcd.setCursor(0, 1);
-    lcd.print(instrs[cur_instr].rhythms[mode].cur_rhythm + 1);
+    lcd.print(getChoiceNumber(cur_instr, 0, mode,
+                              instr_states[cur_instr].cur_rhythms[0][mode]) + 1);
     lcd.print(": ");
-    // get current rhythm data from r_func
-    lcd.print(instrs[cur_instr].cur_rhythm.name);
+    printRhythmName(cur_instr, 0);
 
     if (edit) {
       // Edit mode
       lcd.setCursor(14, 1);
       lcd.print(" E");
     }
-    displayBeat(step_counter, true);
+    displayBeat(getStepCounter(), true);
   }
 
   void computeUp() {
     if (edit) {
-      if (instrs[cur_instr].rhythms[mode].rhythm_count < 2) {
-        return;
-      }
-      if (instrs[cur_instr].rhythms[mode].cur_rhythm + 1 <
-          instrs[cur_instr].rhythms[mode].rhythm_count) {
-        instrs[cur_instr].rhythms[mode].cur_rhythm++;
-      }
-      else {
-        instrs[cur_instr].rhythms[mode].cur_rhythm = 0;
-      }
-      instrs[cur_instr].rhythms[mode].rhythms[
-        instrs[cur_instr].rhythms[mode].cur_rhythm](&instrs[cur_instr].cur_rhythm);
-      saveInstrument(instrs[cur_instr]);
+      selectRhythm(cur_instr, 0, 1);
     }
     else {
       if (cur_instr + 1 < instrument_count) {
@@ -228,19 +512,7 @@ class SetRhythmView: public View {
 
   void computeDown() {
     if (edit) {
-      if (instrs[cur_instr].rhythms[mode].rhythm_count < 2) {
-        return;
-      }
-      if (instrs[cur_instr].rhythms[mode].cur_rhythm - 1 >= 0) {
-        instrs[cur_instr].rhythms[mode].cur_rhythm--;
-      }
-      else {
-        instrs[cur_instr].rhythms[mode].cur_rhythm =
-          instrs[cur_instr].rhythms[mode].rhythm_count - 1;
-      }
-      instrs[cur_instr].rhythms[mode].rhythms[
-        instrs[cur_instr].rhythms[mode].cur_rhythm](&instrs[cur_instr].cur_rhythm);
-      saveInstrument(instrs[cur_instr]);
+      selectRhythm(cur_instr, 0, -1);
     }
     else {
       if (cur_instr - 1 >= 0) {
@@ -278,35 +550,24 @@ class SetBreakView: public View {
     lcd.home();
     // write mode name
     lcd.print("Break ");
-    lcd.print(instrs[cur_instr].name);
+    lcd.print((const __FlashStringHelper*) instrs[cur_instr].name);
     lcd.setCursor(0, 1);
-    lcd.print(instrs[cur_instr].breaks[mode].cur_rhythm + 1);
+    lcd.print(getChoiceNumber(cur_instr, 1, mode,
+                              instr_states[cur_instr].cur_rhythms[1][mode]) + 1);
     lcd.print(": ");
-    lcd.print(instrs[cur_instr].cur_break.name);
+    printRhythmName(cur_instr, 1);
 
     if (edit) {
       // Edit mode
       lcd.setCursor(14, 1);
       lcd.print(" E");
     }
-    displayBeat(step_counter, true);
+    displayBeat(getStepCounter(), true);
   }
 
   void computeUp() {
     if (edit) {
-      if (instrs[cur_instr].breaks[mode].rhythm_count < 2) {
-        return;
-      }
-      if (instrs[cur_instr].breaks[mode].cur_rhythm + 1 <
-          instrs[cur_instr].breaks[mode].rhythm_count) {
-        instrs[cur_instr].breaks[mode].cur_rhythm++;
-      }
-      else {
-        instrs[cur_instr].breaks[mode].cur_rhythm = 0;
-      }
-      instrs[cur_instr].breaks[mode].rhythms[
-        instrs[cur_instr].breaks[mode].cur_rhythm](&instrs[cur_instr].cur_break);
-      saveInstrument(instrs[cur_instr]);
+      selectRhythm(cur_instr, 1, 1);
     }
     else {
       if (cur_instr + 1 < instrument_count) {
@@ -321,19 +582,7 @@ class SetBreakView: public View {
 
   void computeDown() {
     if (edit) {
-      if (instrs[cur_instr].breaks[mode].rhythm_count < 2) {
-        return;
-      }
-      if (instrs[cur_instr].breaks[mode].cur_rhythm - 1 >= 0) {
-        instrs[cur_instr].breaks[mode].cur_rhythm--;
-      }
-      else {
-        instrs[cur_instr].breaks[mode].cur_rhythm =
-          instrs[cur_instr].breaks[mode].rhythm_count - 1;
-      }
-      instrs[cur_instr].breaks[mode].rhythms[
-        instrs[cur_instr].breaks[mode].cur_rhythm](&instrs[cur_instr].cur_break);
-      saveInstrument(instrs[cur_instr]);
+      selectRhythm(cur_instr, 1, -1);
     }
     else {
       if (cur_instr - 1 >= 0) {
@@ -362,383 +611,2810 @@ class SetBreakView: public View {
   }
 } set_break_view;
 
-const int view_count=3;
-int view_index=0;
-View* views[view_count] = {
-  &main_view,
-  &set_rhythm_view,
-  &set_break_view
-};
-View* cur_view = views[view_index];
-
-
-void sendMIDI(const int cmd, const int note, const int velocity) {
-  // if (cmd != last_status_byte)
-  Serial1.write(cmd);
-  Serial1.write(note);
-  Serial1.write(velocity);
-  // if (cmd != last_status_byte)
-  //  Serial.write(cmd);
-  // do not use running status over USB. The serial to MIDI
-  // converter has problems with it
-  Serial.write(cmd);
-  Serial.write(note);
-  Serial.write(velocity);
-  last_status_byte = cmd;
-};
-
-void sendShortMIDI(const int cmd, const int val) {
-  if (cmd != last_status_byte)
-    Serial1.write(cmd);
-  Serial1.write(val);
-  // if (cmd != last_status_byte)
-  //   Serial.write(cmd);
-  // see above
-  Serial.write(cmd);
-  Serial.write(val);
-  last_status_byte = cmd;
-}
-
-void escapeLCDNum(const int number, const int max_digits) {
-  for (int i=max_digits-1;number < pow(10, i);i--) {
-    lcd.print(" ");
-  }
-  lcd.print(number);
-}
-
-void displayBeat(const int step, const boolean force_redraw) {
-  int local_step = (step / subdivision) % numerator;
-  if (force_redraw || step == 0 ||
-      local_step != ((step - 1) / subdivision) % numerator) {
-    // LCD
-    lcd.setCursor(14, 0);
-    escapeLCDNum(local_step + 1, 2);
+class FeelView: public View {
+  /* Swing (Up/Down) and groove (Enter) of the current mode */
+  void updateDisplay() {
+    lcd.clear();
+    lcd.home();
+    lcd.print("Swing ");
+    lcd.print((int) mode_feels[mode].swing);
+    lcd.print("%");
+    lcd.setCursor(0, 1);
+    lcd.print((const __FlashStringHelper*)
+              grooves[mode_feels[mode].groove].name);
   }
 
-  // LED
-  if (step == 0 ||
-      local_step != ((step - 1) / subdivision) % numerator) {
-    if (local_step == 0)
-      analogWrite(metronome_pin, 0xff);
-    else
-      analogWrite(metronome_pin, 0x20);
-  }
-  else {
-    int part = 4;
-    if (local_step == 0)
-      // decrease to enlight first beat longer
-      part = 4;
-    if (step % subdivision  > subdivision / part) {
-      analogWrite(metronome_pin, 0);
+  void computeUp() {
+    if (mode_feels[mode].swing < 75) {
+      mode_feels[mode].swing++;
+      saveFeel(mode);
+      updateRhythms();
     }
+    updateDisplay();
   }
-}
 
-void computeStep(int step) {
-  if (muted) {
-    return;
-  }
-  for (int i=0;i<instrument_count;i++) {
-    Instrument instr = instrs[i];
-    for (int l=0;l<2;l++) {
-      Rhythm r;
-      if (l==0) {
-        if (is_break && mode_break_mute[mode]) {
-          continue;
-        }
-        else {
-          r = instr.cur_rhythm;
-        }
-      }
-      else {
-        if (is_break) {
-          r = instr.cur_break;
-        }
-        else {
-          continue;
-        }
-      }
-      if (!isLocalStep(step, r.subdivision) || r.note_count == 0)
-        continue;
-      int local_step = getLocalStep(step, r.subdivision, r.note_count);
-      if (r.notes[local_step] > 0) {
-        int note_vol = r.notes[local_step] * (analogRead(instr.input_pin) / 1023.0);
-        if (vol > 0 && note_vol > 0) {
-          sendMIDI(NOTE_ON | drum_channel, instr.midi_note, note_vol);
-        }
-      }
+  void computeDown() {
+    if (mode_feels[mode].swing > 50) {
+      mode_feels[mode].swing--;
+      saveFeel(mode);
+      updateRhythms();
     }
+    updateDisplay();
   }
-}
 
-void nextView() {
-  if (view_index + 1 < view_count) {
-    view_index++;
+  void computeEnter() {
+    unsigned char& groove = mode_feels[mode].groove;
+    groove = groove + 1 < groove_count ? groove + 1 : 0;
+    saveFeel(mode);
+    updateRhythms();
+    updateDisplay();
   }
-  else {
-    view_index = 0;
+
+  void computeLeft() {
+    prevView();
   }
-  cur_view = views[view_index];
-  cur_view->updateDisplay();
-}
 
-void prevView() {
-  if (view_index - 1 >= 0) {
-    view_index--;
+  void computeRight() {
+    nextView();
   }
-  else {
-    view_index = view_count - 1;
+} feel_view;
+
+class HumanizeView: public View {
+  /* Humanize on and off (Enter) and its seed (Up/Down) */
+  void updateDisplay() {
+    lcd.clear();
+    lcd.home();
+    lcd.print("Humanize ");
+    lcd.print(humanize ? "on" : "off");
+    lcd.setCursor(0, 1);
+    lcd.print("Seed ");
+    lcd.print(humanize_seed);
   }
-  cur_view = views[view_index];
-  cur_view->updateDisplay();
-}
 
-boolean computeJoystick() {
-  /* Returns wether change occured */
-  boolean changed = false;
-  // UP
-  boolean inp = digitalRead(up_pin);
-  // Inputs are connected to pullup
-  if (!inp && last_up) {
-    // changed to HIGH
-    changed = true;
-    cur_view->computeUp();
-  }
-  last_up = inp;
-  // DOWN
-  inp = digitalRead(down_pin);
-  if (!inp && last_down) {
-    // changed to HIGH
-    changed = true;
-    cur_view->computeDown();
-  }
-  last_down = inp;
-  // LEFT
-  inp = digitalRead(left_pin);
-  if (!inp && last_left) {
-    // changed to HIGH
-    changed = true;
-    cur_view->computeLeft();
-  }
-  last_left = inp;
-  // RIGHT
-  inp = digitalRead(right_pin);
-  if (!inp && last_right) {
-    // changed to HIGH
-    changed = true;
-    cur_view->computeRight();
-  }
-  last_right = inp;
-  // ENTER
-  inp = digitalRead(enter_pin);
-  if (!inp && last_enter) {
-    // changed to HIGH
-    changed = true;
-    cur_view->computeEnter();
-  }
-  last_enter = inp;
-  return changed;
-}
-
-boolean computeBreakSwitch() {
-  last_break = is_break;
-  is_break = !digitalRead(break_pin);
-  if (is_break != last_break) {
-    return true;
-  }
-  return false;
-}
-
-boolean computeMuteSwitch() {
-  last_muted = muted;
-  muted = !digitalRead(mute_switch_pin);
-  if (muted != last_muted) {
-    return true;
-  }
-  return false;
-}
-
-long getDelay(long sub) {
-  /* sub: Subtract from delay */
-  // 1 minute (60000 milliseconds)
-  // divide by beats per minute
-  // divide by subdivision
-  long delay_time = 60000 / bpm / subdivision - sub;
-  if (delay_time > 0)
-    return delay_time;
-  return 0;
-}
+  void computeUp() {
+    setHumanize(humanize, humanize_seed + 1);
+    updateDisplay();
+  }
 
-int getLocalStep(int global_step, int r_subdiv, int r_note_count) {
-  /*
-   * Step: global step
-   * r_subdiv: Subdivision of rhythm
-   * r_note_count: Number of notes in rhythm
-  */
-  // global step (beats since start * subdivision)
-  return global_step / (subdivision / (r_subdiv / denominator)) % r_note_count;
-}
-boolean isLocalStep(int global_step, int r_subdiv) {
-  /*
-   * Step: global step
-   * r_subdiv: Subdivision of rhythm
-  */
-  return r_subdiv != 0
-         && global_step % (subdivision / (r_subdiv / denominator)) == 0;
-}
+  void computeDown() {
+    setHumanize(humanize, humanize_seed - 1);
+    updateDisplay();
+  }
 
-void updateRhythms() {
-  for (int i=0;i<instrument_count;i++) {
-    instrs[i].rhythms[mode].rhythms[
-      instrs[i].rhythms[mode].cur_rhythm](&instrs[i].cur_rhythm);
-    instrs[i].breaks[mode].rhythms[
-      instrs[i].breaks[mode].cur_rhythm](&instrs[i].cur_break);
+  void computeEnter() {
+    setHumanize(!humanize, humanize_seed);
+    noInterrupts();
+    seedRandom(humanize_seed);
+    interrupts();
+    updateDisplay();
   }
-}
 
-/* Getter and setter (for EEPROM) */
-int getMode() {
-  int mode_eeprom = EEPROM.read(mode_pos);
-  if (mode_eeprom >= 0 && mode_eeprom < mode_count) {
-    return mode_eeprom;
+  void computeLeft() {
+    prevView();
   }
-  return 0;
-}
 
-void setMode(int new_mode) {
-  if (new_mode == (int) Mode::WALTZ) {
-    numerator = 3;
-    denominator = 4;
+  void computeRight() {
+    nextView();
   }
-  else {
-    numerator = 4;
-    denominator = 4;
+} humanize_view;
+
+class FillView: public View {
+  /* Fills every 4 or 8 bars or none (Up/Down) */
+  void updateDisplay() {
+    lcd.clear();
+    lcd.home();
+    lcd.print("Fills");
+    lcd.setCursor(0, 1);
+    if (fill_bars == 0) {
+      lcd.print("off");
+      return;
+    }
+    lcd.print("every ");
+    lcd.print(fill_bars);
+    lcd.print(" bars");
   }
-  if (mode != new_mode) {
-    mode = new_mode;
-    EEPROM_update(mode_pos, mode);
-    updateRhythms();
+
+  void computeUp() {
+    setFillBars(fill_bars == 0 ? 4 : (fill_bars == 4 ? 8 : 0));
   }
-}
 
-void saveInstrument(Instrument instr) {
-  int cur_pos = instruments_pos + instr.uid * INSTR_STORE_MAX_SIZE;
-  EEPROM_update(cur_pos, instr.uid);
-  cur_pos++;
-  // current rhythms for every mode in the instrument
-  for (int i=0;i<mode_count;i++) {
-    EEPROM_update(cur_pos + i, instr.rhythms[i].cur_rhythm);
+  void computeDown() {
+    setFillBars(fill_bars == 0 ? 8 : (fill_bars == 8 ? 4 : 0));
   }
-  cur_pos += MAX_MODES;
-  // current break for every mode in the instrument
-  for (int i=0;i<mode_count;i++) {
-    EEPROM_update(cur_pos + i, instr.breaks[i].cur_rhythm);
+
+  void setFillBars(int bars) {
+    cancelFill();
+    fill_bars = bars;
+    if (settings.fill_bars != bars) {
+      settings.fill_bars = bars;
+      markSettingsDirty();
+    }
+    updateDisplay();
   }
-  cur_pos += MAX_MODES;
-}
 
-void restoreInstrument(Instrument* instr) {
-  int cur_pos = instruments_pos + instr->uid * INSTR_STORE_MAX_SIZE;
-  if (EEPROM.read(cur_pos) != instr->uid) {
-    // Last write didn't come from this instrument -> don't change anything
-    return;
+  void computeLeft() {
+    prevView();
   }
-  cur_pos++;
-  for (int i=0;i<mode_count;i++) {
-    instr->rhythms[i].cur_rhythm = EEPROM.read(cur_pos + i);
-    if (instr->rhythms[i].cur_rhythm >= instr->rhythms[i].rhythm_count) {
-      instr->rhythms[i].cur_rhythm = 0;
-      EEPROM_update(cur_pos + i, 0);
-    }
+
+  void computeRight() {
+    nextView();
   }
-  instr->rhythms[mode].rhythms[
-    instr->rhythms[mode].cur_rhythm](&instr->cur_rhythm);
-  cur_pos += MAX_MODES;
-  for (int i=0;i<mode_count;i++) {
-    instr->breaks[i].cur_rhythm = EEPROM.read(cur_pos + i);
-    if (instr->breaks[i].cur_rhythm >= instr->breaks[i].rhythm_count) {
-      instr->breaks[i].cur_rhythm = 0;
-      EEPROM_update(cur_pos + i, 0);
+} fill_view;
+
+class QuantizeView: public View {
+  /* Where new rhythms, breaks and the break switch take over (Up/Down) */
+  void updateDisplay() {
+    lcd.clear();
+    lcd.home();
+    lcd.print("Changes on");
+    lcd.setCursor(0, 1);
+    switch (getQuantize()) {
+    case QUANTIZE_BAR:
+      lcd.print("next bar");
+      break;
+    case QUANTIZE_BEAT:
+      lcd.print("next beat");
+      break;
+    default:
+      lcd.print("next step");
+      break;
     }
   }
-  instr->breaks[mode].rhythms[
-    instr->breaks[mode].cur_rhythm](&instr->cur_break);
-  cur_pos += MAX_MODES;
-}
-
 
-void setup() {
-  pinMode(up_pin, INPUT_PULLUP);
-  pinMode(down_pin, INPUT_PULLUP);
-  pinMode(left_pin, INPUT_PULLUP);
-  pinMode(right_pin, INPUT_PULLUP);
-  pinMode(enter_pin, INPUT_PULLUP);
+  void computeUp() {
+    setQuantize((getQuantize() + 1) % quantize_count);
+    updateDisplay();
+  }
 
-  pinMode(break_pin, INPUT_PULLUP);
-  pinMode(mute_switch_pin, INPUT_PULLUP);
+  void computeDown() {
+    setQuantize((getQuantize() + quantize_count - 1) % quantize_count);
+    updateDisplay();
+  }
 
-  pinMode(metronome_pin, OUTPUT);
+  void computeLeft() {
+    prevView();
+  }
 
-  lcd.begin(16, 2);
-  lcd.print("Setup");
-  // Setup Serial (TX0 and USB) with the baudrate 115200 to be able to use
-  // an Serial to MIDI converter on a PC
-  Serial.begin(115200);
-  while(!Serial) ;
-  // Setup Serial1 with the standard MIDI baud rate of 31250
-  // to get MIDI on TX1 (pin 18)
-  Serial1.begin(31250);
-  while(!Serial1) ;
-  step_counter = 0;
+  void computeRight() {
+    nextView();
+  }
+} quantize_view;
 
-  // Read EEPROM content
-  mode = getMode();
-  setMode(mode);
-  for (int i=0;i<instrument_count;i++) {
-    restoreInstrument(&instrs[i]);
+class CurveView: public View {
+  /* Velocity curve of an instrument: Up/Down instrument, Enter curve */
+  int cur_instr = 0;
+  void updateDisplay() {
+    lcd.clear();
+    lcd.home();
+    lcd.print("Curve ");
+    lcd.print((const __FlashStringHelper*) instrs[cur_instr].name);
+    lcd.setCursor(0, 1);
+    lcd.print((const __FlashStringHelper*)
+              velocity_curves[settings.curves[cur_instr]].name);
   }
-  muted = !digitalRead(mute_switch_pin);
-}
 
+  void computeUp() {
+    cur_instr = cur_instr + 1 < instrument_count ? cur_instr + 1 : 0;
+    updateDisplay();
+  }
 
-unsigned long start_millis;
+  void computeDown() {
+    cur_instr = cur_instr > 0 ? cur_instr - 1 : instrument_count - 1;
+    updateDisplay();
+  }
 
-void loop() {
-  start_millis = millis();
-  if (step_counter > subdivision * max_bars - 1) step_counter = 0;
-  computeBreakSwitch();
-  if (computeMuteSwitch()) {
-    cur_view->updateDisplay();
+  void computeEnter() {
+    int curve = settings.curves[cur_instr] + 1;
+    setCurve(cur_instr, curve < curve_count ? curve : 0);
+    updateDisplay();
   }
-  computeStep(step_counter);
-  displayBeat(step_counter, false);
-  step_counter++;
 
-  computeJoystick();
+  void computeLeft() {
+    prevView();
+  }
 
-  vol = map(analogRead(vol_pin), 0, 1023, 0, 0x7f);
-  if (vol != last_vol) {
-    if (pre_last_vol != vol) {
-      sendMIDI(CONTROL_CHANGE | drum_channel, 0x07, vol);
-    }
-    pre_last_vol = last_vol;
-    last_vol = vol;
+  void computeRight() {
+    nextView();
   }
-  bpm = map(analogRead(bmp_pin), 0, 1023, 10, 220);
-  if (bpm != last_bpm) {
-    if (pre_last_bpm != bpm) {
-      cur_view->updateDisplay();
+} curve_view;
+
+class SongView: public View {
+  /* Select, start and stop a song */
+  void updateDisplay() {
+    lcd.clear();
+    lcd.home();
+    lcd.print("Song");
+    if (song_playing && song_current >= 0) {
+      lcd.print(" ");
+      lcd.print(song_current + 1);
+    }
+    lcd.setCursor(0, 1);
+    lcd.print((const __FlashStringHelper*) songs[cur_song].name);
+  }
+
+  void computeUp() {
+    if (song_playing) {
+      return;
+    }
+    cur_song = cur_song + 1 < song_count ? cur_song + 1 : 0;
+    updateDisplay();
+  }
+
+  void computeDown() {
+    if (song_playing) {
+      return;
+    }
+    cur_song = cur_song > 0 ? cur_song - 1 : song_count - 1;
+    updateDisplay();
+  }
+
+  void computeEnter() {
+    if (song_playing) {
+      stopSong();
+    }
+    else {
+      startSong(cur_song);
+    }
+    updateDisplay();
+  }
+
+  void computeLeft() {
+    prevView();
+  }
+
+  void computeRight() {
+    nextView();
+  }
+} song_view;
+
+class MidiView: public View {
+  /* Diagnostics of the MIDI output */
+  void updateDisplay() {
+    lcd.clear();
+    lcd.home();
+    lcd.print("MIDI overflows");
+    lcd.setCursor(0, 1);
+    lcd.print("DIN ");
+    lcd.print(getMIDIOverflows(MIDI_DIN));
+    lcd.print(" USB ");
+    lcd.print(getMIDIOverflows(MIDI_USB));
+  }
+
+  void computeEnter() {
+    // reset the counters
+    noInterrupts();
+    for (int port=0;port<MIDI_PORT_COUNT;port++) {
+      midi_ports[port].overflows = 0;
+    }
+    interrupts();
+    updateDisplay();
+  }
+
+  void computeLeft() {
+    prevView();
+  }
+
+  void computeRight() {
+    nextView();
+  }
+} midi_view;
+
+class LatencyView: public View {
+  /*
+   * Note on latency of one instrument on the DIN port in 1/10 ms:
+   * the name and the 99th percentile of the jitter in the first line,
+   * min/avg/max/99th percentile of the latency in the second.
+   */
+  int cur_instr = 0;
+  void updateDisplay() {
+    noInterrupts();
+    LatencyStats stats = latency_stats[cur_instr];
+    interrupts();
+    lcd.clear();
+    lcd.home();
+    lcd.print((const __FlashStringHelper*) instrs[cur_instr].name);
+    if (stats.count == 0) {
+      lcd.setCursor(0, 1);
+      lcd.print("no notes");
+      return;
+    }
+    // the beat is shown in the last two columns
+    lcd.setCursor(11, 0);
+    lcd.print("j");
+    lcd.print(getLatencyPercentile(stats.jitter, stats.count, 99) / 100);
+    lcd.setCursor(0, 1);
+    lcd.print(stats.min / 100);
+    lcd.print("/");
+    lcd.print((unsigned int) (stats.sum / stats.count / 100));
+    lcd.print("/");
+    lcd.print(stats.max / 100);
+    lcd.print("/");
+    lcd.print(getLatencyPercentile(stats.latency, stats.count, 99) / 100);
+  }
+
+  void computeUp() {
+    if (cur_instr + 1 < instrument_count) {
+      cur_instr++;
+    }
+    else {
+      cur_instr = 0;
+    }
+    updateDisplay();
+  }
+
+  void computeDown() {
+    if (cur_instr - 1 >= 0) {
+      cur_instr--;
+    }
+    else {
+      cur_instr = instrument_count - 1;
+    }
+    updateDisplay();
+  }
+
+  void computeEnter() {
+    resetLatency();
+    updateDisplay();
+  }
+
+  void computeLeft() {
+    prevView();
+  }
+
+  void computeRight() {
+    nextView();
+  }
+} latency_view;
+
+const int view_count=11;
+int view_index=0;
+View* views[view_count] = {
+  &main_view,
+  &set_rhythm_view,
+  &set_break_view,
+  &feel_view,
+  &humanize_view,
+  &fill_view,
+  &quantize_view,
+  &curve_view,
+  &song_view,
+  &midi_view,
+  &latency_view
+};
+View* cur_view = views[view_index];
+
+
+void beginMIDI() {
+  // Serial (TX0 and USB) with the baudrate 115200 to be able to use an
+  // Serial to MIDI converter on a PC. Do not use running status over USB,
+  // the serial to MIDI converter has problems with it.
+  UCSR0A = _BV(U2X0);
+  UBRR0 = (F_CPU / 4 / 115200 - 1) / 2;
+  UCSR0B = _BV(TXEN0) | _BV(RXEN0) | _BV(RXCIE0);
+  midi_ports[MIDI_USB].running_status = false;
+  // Serial1 with the standard MIDI baud rate of 31250 to get MIDI on TX1
+  UCSR1A = _BV(U2X1);
+  UBRR1 = (F_CPU / 4 / 31250 - 1) / 2;
+  UCSR1B = _BV(TXEN1) | _BV(RXEN1) | _BV(RXCIE1);
+  midi_ports[MIDI_DIN].running_status = true;
+  // 8N1 is the reset default of UCSRnC
+}
+
+void enableTransmit(int port) {
+  /* Let the UART interrupt empty the queues */
+  if (port == MIDI_DIN) {
+    UCSR1B |= _BV(UDRIE1);
+  }
+  else {
+    UCSR0B |= _BV(UDRIE0);
+  }
+}
+
+boolean queueMIDI(int port, const unsigned char* msg, int len) {
+  /*
+   * Queue a complete message or, if it does not fit, nothing.
+   * Never waits. Called from loop() and from the step interrupt.
+   */
+  MidiPort& p = midi_ports[port];
+  unsigned char sreg = SREG;
+  cli();
+  int start = 0;
+  if (p.running_status && msg[0] == p.last_status) {
+    start = 1;
+  }
+  int used = (p.tail - p.head) & (MIDI_QUEUE_SIZE - 1);
+  if (len - start > MIDI_QUEUE_SIZE - 1 - used) {
+    p.overflows++;
+    SREG = sreg;
+    return false;
+  }
+  for (int i=start;i<len;i++) {
+    p.queue[p.tail] = msg[i];
+    p.tail = (p.tail + 1) & (MIDI_QUEUE_SIZE - 1);
+  }
+  // system common messages cancel running status
+  p.last_status = msg[0] < 0xf0 ? msg[0] : 0;
+  enableTransmit(port);
+  SREG = sreg;
+  return true;
+}
+
+boolean queueRealtimeMIDI(int port, unsigned char data) {
+  /*
+   * Queue a single byte real-time message. It is sent before everything
+   * in the normal queue, even between the bytes of a message.
+   */
+  MidiPort& p = midi_ports[port];
+  unsigned char sreg = SREG;
+  cli();
+  unsigned char tail = (p.realtime_tail + 1) & (MIDI_REALTIME_QUEUE_SIZE - 1);
+  if (tail == p.realtime_head) {
+    p.overflows++;
+    SREG = sreg;
+    return false;
+  }
+  p.realtime[p.realtime_tail] = data;
+  p.realtime_tail = tail;
+  enableTransmit(port);
+  SREG = sreg;
+  return true;
+}
+
+void transmitMIDI(int port) {
+  /* UART data register empty: hand over the next byte */
+  MidiPort& p = midi_ports[port];
+  unsigned char data;
+  if (p.realtime_head != p.realtime_tail) {
+    data = p.realtime[p.realtime_head];
+    p.realtime_head = (p.realtime_head + 1) & (MIDI_REALTIME_QUEUE_SIZE - 1);
+  }
+  else if (p.head != p.tail) {
+    data = p.queue[p.head];
+    if (port == MIDI_DIN && latency_marks_head != latency_marks_tail
+        && latency_marks[latency_marks_head].pos == p.head) {
+      unsigned long latency = micros() - latency_marks[latency_marks_head].due;
+      recordLatency(latency_marks[latency_marks_head].instr,
+                    latency < 0xffff ? latency : 0xffff);
+      latency_marks_head = (latency_marks_head + 1) & (LATENCY_MARK_COUNT - 1);
+    }
+    p.head = (p.head + 1) & (MIDI_QUEUE_SIZE - 1);
+  }
+  else {
+    // nothing left, stop the interrupt until the next queueMIDI()
+    if (port == MIDI_DIN) {
+      UCSR1B &= ~_BV(UDRIE1);
+    }
+    else {
+      UCSR0B &= ~_BV(UDRIE0);
+    }
+    return;
+  }
+  if (port == MIDI_DIN) {
+    UDR1 = data;
+  }
+  else {
+    UDR0 = data;
+  }
+}
+
+ISR(USART0_UDRE_vect) {
+  transmitMIDI(MIDI_USB);
+}
+
+ISR(USART1_UDRE_vect) {
+  transmitMIDI(MIDI_DIN);
+}
+
+void receiveMIDI(int port, unsigned char data) {
+  /*
+   * Parse one received byte. Runs in the UART receive interrupt, so
+   * clocks are handled the moment they arrive.
+   */
+  if (data >= 0xf8) {
+    // real-time messages may come between the bytes of any message
+    receiveRealtimeMIDI(data);
+    return;
+  }
+  MidiParser& p = midi_parsers[port];
+  if (data & 0x80) {
+    if (data == END_OF_EXCLUSIVE && p.status == SYSTEM_EXCLUSIVE
+        && !p.sysex_overflow) {
+      // loop() reads it from the parser
+      p.sysex_ready = true;
+    }
+    p.status = data;
+    p.count = 0;
+    if (data < 0xc0 || (data >= 0xe0 && data < 0xf0) || data == SONG_POSITION) {
+      p.length = 2;
+    }
+    else if (data < 0xe0 || data == 0xf1 || data == 0xf3) {
+      p.length = 1;
+    }
+    else if (data == SYSTEM_EXCLUSIVE) {
+      // a message loop() has not read yet is kept, this one is lost
+      p.sysex_overflow = p.sysex_ready;
+      if (!p.sysex_ready) {
+        p.sysex_length = 0;
+      }
+    }
+    else {
+      // the end of SysEx and tune request carry nothing we use
+      p.status = 0;
+    }
+    return;
+  }
+  if (p.status == 0) {
+    return;
+  }
+  if (p.status == SYSTEM_EXCLUSIVE) {
+    if (p.sysex_overflow || p.sysex_length == SYSEX_MAX_SIZE) {
+      p.sysex_overflow = true;
+    }
+    else {
+      p.sysex[p.sysex_length++] = data;
+    }
+    return;
+  }
+  p.data[p.count++] = data;
+  if (p.count == p.length) {
+    p.count = 0;
+    dispatchMIDI(p.status, p.data);
+    if (p.status >= 0xf0) {
+      // no running status for system common messages
+      p.status = 0;
+    }
+  }
+}
+
+void receiveRealtimeMIDI(unsigned char data) {
+  switch (data) {
+  case TIMING_CLOCK:
+    computeClockInput();
+    break;
+  case START:
+    step_counter = 0;
+    bar_start = 0;
+    seekVoices(0);
+    seedRandom(humanize_seed);
+    // fall through
+  case CONTINUE:
+    // a clock follows, the transport messages come from a master
+    enterSlave();
+    ext_running = true;
+    ext_starting = true;
+    break;
+  case STOP:
+    enterSlave();
+    ext_running = false;
+    ext_starting = false;
+    // the note offs would wait for the next tick
+    flushNotes();
+    break;
+  }
+}
+
+void dispatchMIDI(unsigned char status, const unsigned char* data) {
+  /* Act on a complete message. Runs in the UART receive interrupt. */
+  if (status == SONG_POSITION) {
+    long position = data[0] | (data[1] << 7);
+    step_counter = position * position_ticks % wrap_ticks;
+    seekVoices(step_counter);
+  }
+  else if (status == (PROGRAM_CHANGE | drum_channel)
+           || status == (CONTROL_CHANGE | drum_channel)) {
+    // for loop(), dropped when it falls behind
+    unsigned char tail = (midi_in_tail + 1) & (MIDI_IN_QUEUE_SIZE - 1);
+    if (tail != midi_in_head) {
+      MidiMessage& msg = midi_in[midi_in_tail];
+      msg.status = status;
+      msg.data[0] = data[0];
+      msg.data[1] = data[1];
+      midi_in_tail = tail;
+    }
+  }
+}
+
+void computeMIDIInput() {
+  /* Act on the channel messages received since the last call */
+  while (midi_in_head != midi_in_tail) {
+    MidiMessage msg = midi_in[midi_in_head];
+    midi_in_head = (midi_in_head + 1) & (MIDI_IN_QUEUE_SIZE - 1);
+    if ((msg.status & 0xf0) == PROGRAM_CHANGE) {
+      if (msg.data[0] < mode_count) {
+        setMode(msg.data[0]);
+        cur_view->updateDisplay();
+      }
+    }
+    else if (msg.data[0] >= CC_RHYTHM
+             && msg.data[0] < CC_RHYTHM + instrument_count) {
+      queueRhythm(msg.data[0] - CC_RHYTHM, 0, msg.data[1]);
+    }
+    else if (msg.data[0] >= CC_BREAK
+             && msg.data[0] < CC_BREAK + instrument_count) {
+      queueRhythm(msg.data[0] - CC_BREAK, 1, msg.data[1]);
+    }
+  }
+}
+
+void computeSysEx() {
+  /* Act on received SysEx messages and go on with a pattern transfer */
+  for (int port=0;port<MIDI_PORT_COUNT;port++) {
+    MidiParser& p = midi_parsers[port];
+    if (p.sysex_ready) {
+      handleSysEx(port, p.sysex, p.sysex_length);
+      p.sysex_ready = false;
+    }
+  }
+  if (transfer_state == TRANSFER_WRITING) {
+    computePatternWriter();
+  }
+  else if (transfer_state == TRANSFER_DUMPING) {
+    computeDump();
+  }
+}
+
+void handleSysEx(int port, const unsigned char* msg, int length) {
+  /* msg: the bytes between F0 and F7 */
+  if (length < 4 || msg[0] != SYSEX_ID || msg[1] != SYSEX_DEVICE) {
+    return;
+  }
+  unsigned char command = msg[2];
+  if (command == SYSEX_DATA || command == SYSEX_END) {
+    if (transfer_state != TRANSFER_RECEIVING || port != transfer_port) {
+      return;
+    }
+  }
+  if (command == SYSEX_DATA) {
+    int offset = msg[3];
+    int count = length - 4;
+    if (offset != transfer_length
+        || transfer_length + count > PATTERN_CRC_POS) {
+      transfer_error = true;
+      return;
+    }
+    memcpy(&pattern_image[transfer_length], &msg[4], count);
+    transfer_length += count;
+    return;
+  }
+  if (command == SYSEX_END) {
+    transfer_state = TRANSFER_IDLE;
+    uint16_t crc = 0xffff;
+    for (int i=0;i<transfer_length;i++) {
+      crc = updateCRC(crc, pattern_image[i]);
+    }
+    uint16_t sent = msg[3] | msg[4] << 7 | (uint16_t) msg[5] << 14;
+    if (length != 6 || transfer_error || crc != sent) {
+      sendSysExStatus(port, transfer_slot, SYSEX_CRC_ERROR);
+      return;
+    }
+    if (!checkPattern(pattern_image, transfer_length)) {
+      sendSysExStatus(port, transfer_slot, SYSEX_INVALID);
+      return;
+    }
+    memset(&pattern_image[transfer_length], 0,
+           PATTERN_CRC_POS - transfer_length);
+    pattern_image[PATTERN_CRC_POS] = crc & 0xff;
+    pattern_image[PATTERN_CRC_POS + 1] = crc >> 8;
+    startPatternWriter(port, transfer_slot, PATTERN_SLOT_SIZE);
+    return;
+  }
+  int slot = msg[3];
+  if (slot >= PATTERN_SLOT_COUNT
+      && !(command == SYSEX_DUMP_REQUEST && slot == SYSEX_ALL_SLOTS)) {
+    sendSysExStatus(port, slot, SYSEX_INVALID);
+    return;
+  }
+  if (transfer_state == TRANSFER_WRITING
+      || transfer_state == TRANSFER_DUMPING) {
+    sendSysExStatus(port, slot, SYSEX_BUSY);
+    return;
+  }
+  switch (command) {
+  case SYSEX_BEGIN:
+    // also drops an upload that did not end
+    transfer_state = TRANSFER_RECEIVING;
+    transfer_port = port;
+    transfer_slot = slot;
+    transfer_length = 0;
+    transfer_error = false;
+    break;
+  case SYSEX_DELETE:
+    pattern_image[0] = NO_PATTERN;
+    startPatternWriter(port, slot, 1);
+    break;
+  case SYSEX_DUMP_REQUEST:
+    transfer_state = TRANSFER_IDLE;
+    startDump(port, slot);
+    break;
+  }
+}
+
+void sendSysExStatus(int port, int slot, int status) {
+  const unsigned char data[] = {
+    (unsigned char) slot, (unsigned char) status
+  };
+  queueSysEx(port, SYSEX_STATUS, data, 2);
+}
+
+boolean queueSysEx(int port, unsigned char command,
+                   const unsigned char* data, int length) {
+  /* Queue F0 7D 01 command data F7 as one message */
+  unsigned char msg[SYSEX_MAX_SIZE + 2];
+  msg[0] = SYSTEM_EXCLUSIVE;
+  msg[1] = SYSEX_ID;
+  msg[2] = SYSEX_DEVICE;
+  msg[3] = command;
+  memcpy(&msg[4], data, length);
+  msg[4 + length] = END_OF_EXCLUSIVE;
+  return queueMIDI(port, msg, length + 5);
+}
+
+int getMIDIQueueFree(int port) {
+  /* Bytes that still fit into the output queue of port */
+  MidiPort& p = midi_ports[port];
+  noInterrupts();
+  int used = (p.tail - p.head) & (MIDI_QUEUE_SIZE - 1);
+  interrupts();
+  return MIDI_QUEUE_SIZE - 1 - used;
+}
+
+uint16_t updateCRC(uint16_t crc, unsigned char data) {
+  /* CRC-16-CCITT, polynomial 0x1021, start with 0xffff */
+  crc ^= (uint16_t) data << 8;
+  for (int i=0;i<8;i++) {
+    crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+boolean checkPattern(const unsigned char* image, int length) {
+  /* Whether image holds a pattern that can be played, without the CRC */
+  const PatternHeader* h = (const PatternHeader*) image;
+  if (length < (int) sizeof(PatternHeader)
+      || h->version != PATTERN_VERSION
+      || h->instrument >= instrument_count
+      || h->layer > 1
+      || h->mode >= mode_count
+      || h->numerator == 0
+      // a power of two, a 64th note is the shortest the player supports
+      || h->denominator == 0
+      || h->denominator > 64
+      || (h->denominator & (h->denominator - 1)) != 0
+      // at most 8 whole notes per bar
+      || h->numerator > 8 * h->denominator
+      // at least a tick per note
+      || h->subdivision == 0
+      || h->subdivision > 4 * subdivision
+      || h->note_count == 0
+      || h->note_count > PATTERN_MAX_NOTES) {
+    return false;
+  }
+  if (length != (int) sizeof(PatternHeader) + h->note_count) {
+    return false;
+  }
+  // a schedule holds SCHEDULE_MAX_EVENTS sounding notes
+  int sounding = 0;
+  for (int n=0;n<h->note_count;n++) {
+    if (image[sizeof(PatternHeader) + n] != 0) {
+      sounding++;
+    }
+  }
+  return sounding <= SCHEDULE_MAX_EVENTS;
+}
+
+int getPatternPos(int slot) {
+  return pattern_store_pos + slot * PATTERN_SLOT_SIZE;
+}
+
+unsigned char getPatternKey(int instr, int layer, int m) {
+  return instr | layer << 3 | m << 4;
+}
+
+void loadPatternIndex() {
+  /* Find the valid patterns in the store */
+  for (int slot=0;slot<PATTERN_SLOT_COUNT;slot++) {
+    pattern_keys[slot] = NO_PATTERN;
+    int pos = getPatternPos(slot);
+    if (EEPROM.read(pos) != PATTERN_VERSION) {
+      continue;
+    }
+    for (int i=0;i<PATTERN_SLOT_SIZE;i++) {
+      pattern_image[i] = EEPROM.read(pos + i);
+    }
+    const PatternHeader* h = (const PatternHeader*) pattern_image;
+    int length = sizeof(PatternHeader) + h->note_count;
+    if (length > PATTERN_CRC_POS || !checkPattern(pattern_image, length)) {
+      continue;
+    }
+    uint16_t crc = 0xffff;
+    for (int i=0;i<length;i++) {
+      crc = updateCRC(crc, pattern_image[i]);
+    }
+    if (pattern_image[PATTERN_CRC_POS] == (crc & 0xff)
+        && pattern_image[PATTERN_CRC_POS + 1] == crc >> 8) {
+      pattern_keys[slot] = getPatternKey(h->instrument, h->layer, h->mode);
+    }
+  }
+}
+
+int findPattern(int instr, int layer, int m, int n) {
+  /* Slot of the n-th user pattern of instr for mode m, -1 if none */
+  unsigned char key = getPatternKey(instr, layer, m);
+  for (int slot=0;slot<PATTERN_SLOT_COUNT;slot++) {
+    if (pattern_keys[slot] == key && n-- == 0) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+int getChoiceSlot(int instr, int layer, int m, int choice) {
+  /*
+   * Slot of the user pattern choice (see cur_rhythms) selects, -1 for a
+   * rhythm in flash or a pattern that is gone
+   */
+  if (!(choice & PATTERN_CHOICE)) {
+    return -1;
+  }
+  int slot = choice & ~PATTERN_CHOICE;
+  if (slot >= PATTERN_SLOT_COUNT
+      || pattern_keys[slot] != getPatternKey(instr, layer, m)) {
+    return -1;
+  }
+  return slot;
+}
+
+int getChoiceNumber(int instr, int layer, int m, int choice) {
+  /*
+   * Number of choice among the getChoiceCount() ones, 0 for a pattern
+   * that is gone, which plays the first rhythm
+   */
+  int count = getRhythmCount(getCollection(instr, layer, m));
+  if (!(choice & PATTERN_CHOICE)) {
+    return choice < count ? choice : 0;
+  }
+  int slot = getChoiceSlot(instr, layer, m, choice);
+  if (slot < 0) {
+    return 0;
+  }
+  for (int i=0;i<slot;i++) {
+    if (pattern_keys[i] == pattern_keys[slot]) {
+      count++;
+    }
+  }
+  return count;
+}
+
+int getChoice(int instr, int layer, int m, int number) {
+  /* The choice with number, see getChoiceNumber() */
+  int count = getRhythmCount(getCollection(instr, layer, m));
+  if (number < count) {
+    return number;
+  }
+  int slot = findPattern(instr, layer, m, number - count);
+  return slot < 0 ? 0 : PATTERN_CHOICE | slot;
+}
+
+int getChoiceCount(int instr, int layer, int m) {
+  /* Rhythms (layer 0) or breaks (layer 1) in flash plus user patterns */
+  int count = getRhythmCount(getCollection(instr, layer, m));
+  unsigned char key = getPatternKey(instr, layer, m);
+  for (int slot=0;slot<PATTERN_SLOT_COUNT;slot++) {
+    if (pattern_keys[slot] == key) {
+      count++;
+    }
+  }
+  return count;
+}
+
+void startPatternWriter(int port, int slot, int length) {
+  /* Write the first length bytes of pattern_image to slot */
+  if (pattern_keys[slot] != NO_PATTERN) {
+    // nothing may read the slot while it is half written; what played it
+    // goes on until the next quantize boundary
+    pattern_keys[slot] = NO_PATTERN;
+    if (!song_playing) {
+      cueRhythms();
+    }
+  }
+  transfer_state = TRANSFER_WRITING;
+  transfer_port = port;
+  transfer_slot = slot;
+  transfer_length = length;
+  transfer_pos = 0;
+}
+
+void computePatternWriter() {
+  /* Write the next changed byte, if the EEPROM is not busy */
+  if (!eeprom_is_ready()) {
+    return;
+  }
+  int pos = getPatternPos(transfer_slot);
+  while (transfer_pos < transfer_length) {
+    unsigned char data = pattern_image[transfer_pos];
+    transfer_pos++;
+    if (EEPROM.read(pos + transfer_pos - 1) != data) {
+      EEPROM.write(pos + transfer_pos - 1, data);
+      return;
+    }
+  }
+  transfer_state = TRANSFER_IDLE;
+  if (pattern_image[0] == PATTERN_VERSION) {
+    const PatternHeader* h = (const PatternHeader*) pattern_image;
+    pattern_keys[transfer_slot] =
+      getPatternKey(h->instrument, h->layer, h->mode);
+    if (!song_playing) {
+      cueRhythms();
+    }
+  }
+  sendSysExStatus(transfer_port, transfer_slot, SYSEX_OK);
+  cur_view->updateDisplay();
+}
+
+void startDump(int port, int slot) {
+  /* Send slot, or with SYSEX_ALL_SLOTS every pattern, to port */
+  transfer_port = port;
+  dump_all = slot == SYSEX_ALL_SLOTS;
+  if (dump_all) {
+    slot = 0;
+    while (slot < PATTERN_SLOT_COUNT && pattern_keys[slot] == NO_PATTERN) {
+      slot++;
+    }
+    if (slot == PATTERN_SLOT_COUNT) {
+      // nothing stored
+      sendSysExStatus(port, SYSEX_ALL_SLOTS, SYSEX_OK);
+      return;
+    }
+  }
+  else if (pattern_keys[slot] == NO_PATTERN) {
+    sendSysExStatus(port, slot, SYSEX_INVALID);
+    return;
+  }
+  int pos = getPatternPos(slot);
+  for (int i=0;i<PATTERN_SLOT_SIZE;i++) {
+    pattern_image[i] = EEPROM.read(pos + i);
+  }
+  transfer_state = TRANSFER_DUMPING;
+  transfer_slot = slot;
+  transfer_length = sizeof(PatternHeader)
+    + ((const PatternHeader*) pattern_image)->note_count;
+  transfer_pos = -1;
+}
+
+void computeDump() {
+  /* Send the next message of a dump: begin, data chunks and end */
+  if (getMIDIQueueFree(transfer_port) < MIDI_QUEUE_SIZE / 2 + SYSEX_MAX_SIZE) {
+    return;
+  }
+  unsigned char data[SYSEX_CHUNK_SIZE + 1];
+  if (transfer_pos < 0) {
+    data[0] = transfer_slot;
+    if (queueSysEx(transfer_port, SYSEX_BEGIN, data, 1)) {
+      transfer_pos = 0;
+    }
+    return;
+  }
+  if (transfer_pos < transfer_length) {
+    int count = transfer_length - transfer_pos;
+    if (count > SYSEX_CHUNK_SIZE) count = SYSEX_CHUNK_SIZE;
+    data[0] = transfer_pos;
+    memcpy(&data[1], &pattern_image[transfer_pos], count);
+    if (queueSysEx(transfer_port, SYSEX_DATA, data, count + 1)) {
+      transfer_pos += count;
+    }
+    return;
+  }
+  uint16_t crc = pattern_image[PATTERN_CRC_POS]
+    | pattern_image[PATTERN_CRC_POS + 1] << 8;
+  data[0] = crc & 0x7f;
+  data[1] = (crc >> 7) & 0x7f;
+  data[2] = crc >> 14;
+  if (!queueSysEx(transfer_port, SYSEX_END, data, 3)) {
+    return;
+  }
+  transfer_state = TRANSFER_IDLE;
+  if (dump_all) {
+    int slot = transfer_slot + 1;
+    while (slot < PATTERN_SLOT_COUNT && pattern_keys[slot] == NO_PATTERN) {
+      slot++;
+    }
+    if (slot < PATTERN_SLOT_COUNT) {
+      startDump(transfer_port, slot);
+      dump_all = true;
+    }
+    else {
+      sendSysExStatus(transfer_port, SYSEX_ALL_SLOTS, SYSEX_OK);
+    }
+  }
+}
+
+ISR(USART0_RX_vect) {
+  receiveMIDI(MIDI_USB, UDR0);
+}
+
+ISR(USART1_RX_vect) {
+  receiveMIDI(MIDI_DIN, UDR1);
+}
+
+void sendMIDI(const int cmd, const int note, const int velocity) {
+  const unsigned char msg[] = {
+    (unsigned char) cmd, (unsigned char) note, (unsigned char) velocity
+  };
+  for (int port=0;port<MIDI_PORT_COUNT;port++) {
+    queueMIDI(port, msg, 3);
+  }
+}
+
+void sendShortMIDI(const int cmd, const int val) {
+  const unsigned char msg[] = {(unsigned char) cmd, (unsigned char) val};
+  for (int port=0;port<MIDI_PORT_COUNT;port++) {
+    queueMIDI(port, msg, 2);
+  }
+}
+
+void sendRealtimeMIDI(const int cmd) {
+  for (int port=0;port<MIDI_PORT_COUNT;port++) {
+    queueRealtimeMIDI(port, cmd);
+  }
+}
+
+void sendNote(int instr, int velocity, unsigned long due) {
+  /*
+   * Queue a note on of an instrument and remember when its tick was
+   * to measure how late it leaves the DIN port.
+   */
+  const unsigned char msg[] = {
+    (unsigned char) (NOTE_ON | drum_channel), voices[instr].midi_note,
+    (unsigned char) velocity
+  };
+  unsigned char sreg = SREG;
+  cli();
+  queueMIDI(MIDI_USB, msg, 3);
+  unsigned char pos = midi_ports[MIDI_DIN].tail;
+  unsigned char tail = (latency_marks_tail + 1) & (LATENCY_MARK_COUNT - 1);
+  if (queueMIDI(MIDI_DIN, msg, 3) && tail != latency_marks_head) {
+    LatencyMark& mark = latency_marks[latency_marks_tail];
+    mark.due = due;
+    mark.pos = pos;
+    mark.instr = instr;
+    latency_marks_tail = tail;
+  }
+  SREG = sreg;
+}
+
+void recordLatency(int instr, unsigned int latency) {
+  /* Add a measurement. Runs in the DIN UART interrupt. */
+  LatencyStats& stats = latency_stats[instr];
+  if (stats.count == 0xffff) {
+    // halve everything, the averages and percentiles stay
+    stats.count /= 2;
+    stats.sum /= 2;
+    for (int i=0;i<LATENCY_BUCKETS;i++) {
+      stats.latency[i] /= 2;
+      stats.jitter[i] /= 2;
+    }
+  }
+  if (stats.count == 0 || latency < stats.min) stats.min = latency;
+  if (stats.count == 0 || latency > stats.max) stats.max = latency;
+  unsigned int jitter = 0;
+  if (stats.count > 0) {
+    jitter = latency > stats.last ? latency - stats.last : stats.last - latency;
+  }
+  stats.last = latency;
+  stats.sum += latency;
+  stats.count++;
+  unsigned int bucket = latency / LATENCY_BUCKET_US;
+  stats.latency[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+  bucket = jitter / LATENCY_BUCKET_US;
+  stats.jitter[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+}
+
+void resetLatency() {
+  noInterrupts();
+  memset(latency_stats, 0, sizeof(latency_stats));
+  interrupts();
+}
+
+unsigned int getLatencyPercentile(const unsigned int* histogram,
+    unsigned int count, int percent) {
+  /*
+   * Upper bound in microseconds of the bucket the given percentile
+   * falls into. The last bucket has no upper bound, its lower bound is
+   * returned instead.
+   */
+  unsigned long wanted = ((unsigned long) count * percent + 99) / 100;
+  unsigned long seen = 0;
+  for (int i=0;i<LATENCY_BUCKETS - 1;i++) {
+    seen += histogram[i];
+    if (seen >= wanted) {
+      return (i + 1) * LATENCY_BUCKET_US;
+    }
+  }
+  return (LATENCY_BUCKETS - 1) * LATENCY_BUCKET_US;
+}
+
+void sendNoteOff(int instr) {
+  /*
+   * End the note of an instrument. With running status a note on with
+   * velocity 0 does it in two bytes.
+   */
+  for (int port=0;port<MIDI_PORT_COUNT;port++) {
+    if (midi_ports[port].running_status) {
+      const unsigned char msg[] = {
+        (unsigned char) (NOTE_ON | drum_channel), voices[instr].midi_note, 0
+      };
+      queueMIDI(port, msg, 3);
+    }
+    else {
+      const unsigned char msg[] = {
+        (unsigned char) (NOTE_OFF | drum_channel), voices[instr].midi_note,
+        0x40
+      };
+      queueMIDI(port, msg, 3);
+    }
+  }
+}
+
+void flushNotes() {
+  /* Send every pending note off now and All Notes Off after them */
+  unsigned char sreg = SREG;
+  cli();
+  for (int i=0;i<instrument_count;i++) {
+    if (voices[i].delay_slot != NO_NOTE_OFF) {
+      // drop late notes that have not started
+      delay_wheel[voices[i].delay_slot] &= ~(1 << i);
+      voices[i].delay_slot = NO_NOTE_OFF;
+    }
+    if (voices[i].off_slot != NO_NOTE_OFF) {
+      note_wheel[voices[i].off_slot] &= ~(1 << i);
+      voices[i].off_slot = NO_NOTE_OFF;
+      sendNoteOff(i);
+    }
+  }
+  sendMIDI(CONTROL_CHANGE | drum_channel, 123, 0);
+  SREG = sreg;
+}
+
+unsigned int getMIDIOverflows(int port) {
+  noInterrupts();
+  unsigned int overflows = midi_ports[port].overflows;
+  interrupts();
+  return overflows;
+}
+
+void escapeLCDNum(const int number, const int max_digits) {
+  /*
+   * Print number (0 or more) right aligned in max_digits columns. The
+   * digits are counted by subtracting powers of ten: no pow() and no
+   * division, the AVR has neither a float unit nor a divider.
+   */
+  unsigned int rest = number;
+  boolean leading = true;
+  for (int i=DECIMAL_DIGITS-1;i>=0;i--) {
+    char digit = '0';
+    while (rest >= decimal_places[i]) {
+      rest -= decimal_places[i];
+      digit++;
+    }
+    if (leading && digit == '0' && i > 0) {
+      if (i < max_digits) {
+        lcd.print(' ');
+      }
+      continue;
+    }
+    leading = false;
+    lcd.print(digit);
+  }
+}
+
+unsigned int levelToGain(unsigned char level) {
+  /* Q8 gain of a 7 bit pot level: 127 is 256, i.e. 1.0 */
+  return (level << 1) + ((level >> 6) << 1);
+}
+
+unsigned char scaleVelocity(unsigned char velocity, unsigned int gain) {
+  /* velocity times a Q8 gain of at most 1.0 */
+  return ((unsigned int) velocity * gain) >> 8;
+}
+
+void displayBeat(const long step, const boolean force_redraw) {
+  /* Called from loop(), which may skip ticks -> remember the last beat */
+  static int last_beat = -1;
+  unsigned int beat = getBeatTicks();
+  long bar_step = getBarStep(step);
+  int local_step = (bar_step / beat) % bar_beats;
+  boolean new_beat = local_step != last_beat;
+  if (force_redraw || new_beat) {
+    // LCD
+    lcd.setCursor(14, 0);
+    escapeLCDNum(local_step + 1, 2);
+  }
+
+  // LED
+  if (new_beat) {
+    if (local_step == 0)
+      analogWrite(metronome_pin, 0xff);
+    else
+      analogWrite(metronome_pin, 0x20);
+  }
+  else {
+    int part = 4;
+    if (local_step == 0)
+      // decrease to enlight first beat longer
+      part = 4;
+    if (bar_step % beat > beat / part) {
+      analogWrite(metronome_pin, 0);
+    }
+  }
+  last_beat = local_step;
+}
+
+void seedRandom(uint16_t seed) {
+  random_state = seed != 0 ? seed : 1;
+}
+
+uint16_t nextRandom() {
+  /* 16 bit xorshift, never returns 0 */
+  random_state ^= random_state << 7;
+  random_state ^= random_state >> 9;
+  random_state ^= random_state << 8;
+  return random_state;
+}
+
+void startNote(int instr, int velocity, unsigned long due,
+               unsigned char slot) {
+  /* Note on now and its note off after the gate */
+  Voice& voice = voices[instr];
+  if (voice.off_slot != NO_NOTE_OFF) {
+    // still sounding: end it before it starts again
+    note_wheel[voice.off_slot] &= ~(1 << instr);
+    sendNoteOff(instr);
+  }
+  sendNote(instr, velocity, due);
+  voice.off_slot = (slot + voice.gate) & (NOTE_WHEEL_SIZE - 1);
+  note_wheel[voice.off_slot] |= 1 << instr;
+}
+
+void computeStep() {
+  /* Play one tick. Runs in the step timer interrupt. */
+  unsigned long due = micros();
+  // note offs first, a note may start again on this tick
+  unsigned char slot = wheel_tick & (NOTE_WHEEL_SIZE - 1);
+  unsigned char offs = note_wheel[slot];
+  if (offs) {
+    note_wheel[slot] = 0;
+    for (int i=0;i<instrument_count;i++) {
+      if (offs & (1 << i)) {
+        voices[i].off_slot = NO_NOTE_OFF;
+        sendNoteOff(i);
+      }
+    }
+  }
+  unsigned char delayed = delay_wheel[slot];
+  if (delayed) {
+    delay_wheel[slot] = 0;
+    for (int i=0;i<instrument_count;i++) {
+      if (delayed & (1 << i)) {
+        voices[i].delay_slot = NO_NOTE_OFF;
+        startNote(i, voices[i].delayed_velocity, due, slot);
+      }
+    }
+  }
+  wheel_tick++;
+  boolean brk = is_break || song_break || fill_state == FILL_PLAYING;
+  for (int i=0;i<instrument_count;i++) {
+    Voice& voice = voices[i];
+    for (int l=0;l<2;l++) {
+      Schedule& s = *voice.layers[l];
+      if (s.length == 0) {
+        continue;
+      }
+      unsigned char velocity = 0;
+      if (s.event_count > 0 && s.events[s.next].tick == s.pos) {
+        velocity = s.events[s.next].velocity;
+        if (++s.next == s.event_count) s.next = 0;
+      }
+      if (++s.pos == s.length) s.pos = 0;
+      if (velocity == 0 || muted) {
+        continue;
+      }
+      // layer 0: rhythm, layer 1: break
+      if (l == 0 ? brk && mode_break_mute[mode] : !brk) {
+        continue;
+      }
+      // two random words per note, before anything may drop it, so the
+      // sequence only depends on the seed and the notes
+      uint16_t r = 0;
+      uint16_t r_timing = 0;
+      if (humanize) {
+        r = nextRandom();
+        r_timing = nextRandom();
+      }
+      // level 127 has to keep the velocity
+      int note_vol = scaleVelocity(velocity,
+                                   levelToGain(pot_levels[voice.pot]));
+      if (vol == 0 || note_vol == 0) {
+        continue;
+      }
+      unsigned char delay = 0;
+      if (humanize) {
+        if ((((r & 0xff) * 100) >> 8) >= voice.probability) {
+          continue;
+        }
+        r >>= 8;
+        int spread = voice.velocity_spread;
+        note_vol += (int) ((r * (2 * spread + 1)) >> 8) - spread;
+        note_vol = note_vol > 0x7f ? 0x7f : (note_vol < 1 ? 1 : note_vol);
+        delay = (r_timing & 0xff) * (voice.timing_spread + 1) >> 8;
+      }
+      // the response of the sound module
+      note_vol = pgm_read_byte(&voice.curve[note_vol]);
+      if (delay == 0) {
+        startNote(i, note_vol, due, slot);
+        continue;
+      }
+      if (voice.delay_slot != NO_NOTE_OFF) {
+        // the last late note has not started yet: start it now
+        delay_wheel[voice.delay_slot] &= ~(1 << i);
+        startNote(i, voice.delayed_velocity, due, slot);
+      }
+      voice.delay_slot = (slot + delay) & (NOTE_WHEEL_SIZE - 1);
+      voice.delayed_velocity = note_vol;
+      delay_wheel[voice.delay_slot] |= 1 << i;
+    }
+  }
+}
+
+void nextView() {
+  if (view_index + 1 < view_count) {
+    view_index++;
+  }
+  else {
+    view_index = 0;
+  }
+  cur_view = views[view_index];
+  cur_view->updateDisplay();
+}
+
+void prevView() {
+  if (view_index - 1 >= 0) {
+    view_index--;
+  }
+  else {
+    view_index = view_count - 1;
+  }
+  cur_view = views[view_index];
+  cur_view->updateDisplay();
+}
+
+unsigned char sampleButtons() {
+  /* Buttons held down as bits of Button, one read of every port */
+  // all inputs have pullups, a pressed button reads 0
+  unsigned char port_e = ~PINE;
+  unsigned char port_g = ~PING;
+  unsigned char port_h = ~PINH;
+  unsigned char port_a = ~PINA;
+  unsigned char pressed = 0;
+  if (port_e & _BV(PE4)) pressed |= _BV(BUTTON_UP);
+  if (port_e & _BV(PE5)) pressed |= _BV(BUTTON_DOWN);
+  if (port_g & _BV(PG5)) pressed |= _BV(BUTTON_LEFT);
+  if (port_e & _BV(PE3)) pressed |= _BV(BUTTON_RIGHT);
+  if (port_h & _BV(PH3)) pressed |= _BV(BUTTON_ENTER);
+  if (port_a & _BV(PA0)) pressed |= _BV(BUTTON_BREAK);
+  if (port_a & _BV(PA1)) pressed |= _BV(BUTTON_MUTE);
+  return pressed;
+}
+
+void startButtonScanner() {
+  /* Take the buttons as they are and debounce from now on */
+  button_state = sampleButtons();
+  // Timer0 runs for millis(), its compare B match comes once per
+  // overflow, every 1.024 ms
+  OCR0B = 0x80;
+  TIMSK0 |= _BV(OCIE0B);
+}
+
+ISR(TIMER0_COMPB_vect) {
+  unsigned char state = button_state;
+  unsigned char changed = sampleButtons() ^ state;
+  // count down the buttons that differ, start again with the others
+  button_count0 = ~(button_count0 & changed);
+  button_count1 = button_count0 ^ (button_count1 & changed);
+  changed &= button_count0 & button_count1;
+  if (changed == 0) {
+    return;
+  }
+  state ^= changed;
+  button_state = state;
+  unsigned char tail = button_tail;
+  for (unsigned char i=0;i<=BUTTON_MUTE;i++) {
+    if (!(changed & _BV(i))) continue;
+    unsigned char next = (tail + 1) & (BUTTON_QUEUE_SIZE - 1);
+    if (next == button_head) {
+      // loop() is far behind, the state is still right
+      break;
+    }
+    button_events[tail] = i | ((state & _BV(i)) ? BUTTON_PRESSED : 0);
+    tail = next;
+  }
+  button_tail = tail;
+}
+
+void computeButtons() {
+  /* Handle the queued button events */
+  while (button_head != button_tail) {
+    unsigned char event = button_events[button_head];
+    button_head = (button_head + 1) & (BUTTON_QUEUE_SIZE - 1);
+    boolean pressed = event & BUTTON_PRESSED;
+    switch (event & ~BUTTON_PRESSED) {
+    case BUTTON_UP:
+      if (pressed) cur_view->computeUp();
+      break;
+    case BUTTON_DOWN:
+      if (pressed) cur_view->computeDown();
+      break;
+    case BUTTON_LEFT:
+      if (pressed) cur_view->computeLeft();
+      break;
+    case BUTTON_RIGHT:
+      if (pressed) cur_view->computeRight();
+      break;
+    case BUTTON_ENTER:
+      if (pressed) cur_view->computeEnter();
+      break;
+    case BUTTON_BREAK:
+      cueBreak(pressed);
+      break;
+    case BUTTON_MUTE:
+      if (pressed == muted) break;
+      muted = pressed;
+      if (muted) {
+        stopClock();
+        flushNotes();
+      }
+      else {
+        startClock();
+      }
+      cur_view->updateDisplay();
+      break;
+    }
+  }
+}
+
+void setTempo(int new_bpm) {
+  /* Program the step timer for new_bpm beats per minute */
+  unsigned int divisor = new_bpm * subdivision;
+  unsigned int period = tick_counts / divisor;
+  unsigned int remainder = tick_counts % divisor;
+  noInterrupts();
+  tick_period = period;
+  tick_remainder = remainder;
+  tick_divisor = divisor;
+  interrupts();
+}
+
+void startStepTimer() {
+  noInterrupts();
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TCNT1 = 0;
+  OCR1A = tick_period - 1;
+  // CTC mode, prescaler 64
+  TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10);
+  TIMSK1 |= _BV(OCIE1A);
+  interrupts();
+}
+
+ISR(TIMER1_COMPA_vect) {
+  if (slave) {
+    OCR1A = slave_period - 1;
+    if (!ext_running || ext_starting) {
+      return;
+    }
+    if (slave_budget <= 0) {
+      // ahead of the clock, it plays the tick when it comes
+      slave_waiting = true;
+      return;
+    }
+    slave_budget--;
+  }
+  else {
+    if (!ext_running) {
+      // stopped from outside
+      return;
+    }
+    // Length of the next tick: add the fractional part to the accumulator
+    // and stretch the tick by one count whenever it overflows
+    tick_accumulator += tick_remainder;
+    if (tick_accumulator >= tick_divisor) {
+      tick_accumulator -= tick_divisor;
+      OCR1A = tick_period;
+    }
+    else {
+      OCR1A = tick_period - 1;
+    }
+  }
+  playTick();
+}
+
+void playTick() {
+  if (step_counter > wrap_ticks - 1) {
+    step_counter = 0;
+    if (swap_wraps > 0) swap_wraps--;
+  }
+  if (swap_step >= 0 && swap_wraps == 0 && step_counter >= swap_step) {
+    swapSchedules();
+  }
+  if (step_counter == fill_step) {
+    if (fill_state == FILL_ARMED) {
+      startFill();
+    }
+    else {
+      endFill();
+    }
+  }
+  if (step_counter == cue_step) {
+    swapCues();
+  }
+  computeClock();
+  computeStep();
+  step_counter++;
+}
+
+void enterSlave() {
+  /* Let external clocks drive the ticks. Interrupts must be disabled. */
+  if (slave) {
+    return;
+  }
+  slave = true;
+  slave_clocked = false;
+  slave_clock_period = 0;
+  slave_period = OCR1A + 1;
+  slave_budget = 0;
+  slave_waiting = false;
+  slave_last_clock = micros();
+  // no clock of our own
+  clock_state = CLOCK_STOPPED;
+}
+
+void computeClockInput() {
+  /*
+   * An external clock arrived. Runs in the UART receive interrupt.
+   */
+  unsigned long now = micros();
+  if (!slave) {
+    enterSlave();
+  }
+  else if (slave_clocked) {
+    // frequency: moving average of the clock period in timer counts
+    unsigned long measured = (now - slave_last_clock) / 4;
+    if (measured > 0xffff) measured = 0xffff;
+    if (slave_clock_period == 0) {
+      slave_clock_period = measured;
+    }
+    else {
+      slave_clock_period += ((long) measured - slave_clock_period) / 4;
+    }
+  }
+  slave_last_clock = now;
+  slave_clocked = true;
+  if (!ext_running) {
+    return;
+  }
+  if (ext_starting) {
+    // Start/Continue: the first tick falls on this clock
+    ext_starting = false;
+    slave_budget = 0;
+    slave_waiting = true;
+  }
+  slave_budget += clock_ticks;
+  if (slave_budget > 2 * clock_ticks) {
+    // more than a clock behind: skip the ticks that are too late
+    step_counter = (step_counter + slave_budget - clock_ticks)
+      % wrap_ticks;
+    seekVoices(step_counter);
+    slave_budget = clock_ticks;
+  }
+  unsigned int base = slave_period;
+  if (slave_clock_period != 0) {
+    base = slave_clock_period / clock_ticks;
+  }
+  // phase: timer counts we are ahead of the clock
+  long error = 0;
+  if (slave_waiting) {
+    // the tick of this clock is due: play it now
+    slave_waiting = false;
+    slave_budget--;
+    TCNT1 = 0;
+    playTick();
+  }
+  else {
+    unsigned int period = OCR1A + 1;
+    error = (long) (clock_ticks - slave_budget) * period
+      - (period - TCNT1);
+  }
+  // spread half of the phase error over the ticks of this clock
+  long period = base + error / (2 * clock_ticks);
+  if (period < base / 2) period = base / 2;
+  if (period > base * 2) period = base * 2;
+  slave_period = period;
+}
+
+boolean updateSlave() {
+  /*
+   * Go back to the internal clock when the external one stopped.
+   * Returns whether the tempo comes from outside.
+   */
+  noInterrupts();
+  boolean ext = slave;
+  if (slave && micros() - slave_last_clock > slave_timeout) {
+    // the tick length set by setTempo() is still there
+    slave = false;
+    ext_starting = false;
+    // after a Stop it stays stopped until Start, Continue or unmute
+    if (ext_running) {
+      clock_state = muted ? CLOCK_STOPPED : CLOCK_POSITION;
+    }
+  }
+  interrupts();
+  if (ext && !slave) {
+    cur_view->updateDisplay();
+  }
+  return slave;
+}
+
+int getSlaveTempo() {
+  /* Tempo of the external clock, bpm when it is not known yet */
+  noInterrupts();
+  unsigned int clock_period = slave_clock_period;
+  interrupts();
+  if (clock_period == 0) {
+    return bpm;
+  }
+  return tick_counts / 24 / clock_period;
+}
+
+unsigned char addPot(unsigned char pin) {
+  /* Register an analog pin with the scanner, pins may be shared */
+  unsigned char channel = pin - A0;
+  for (unsigned char i=0;i<pot_count;i++) {
+    if (pot_channels[i] == channel) {
+      return i;
+    }
+  }
+  pot_channels[pot_count] = channel;
+  return pot_count++;
+}
+
+void startPotConversion() {
+  unsigned char channel = pot_channels[pot_cur];
+  // AVcc reference, MUX5 selects the channels 8 to 15
+  ADMUX = _BV(REFS0) | (channel & 0x07);
+  if (channel & 0x08) {
+    ADCSRB |= _BV(MUX5);
+  }
+  else {
+    ADCSRB &= ~_BV(MUX5);
+  }
+  ADCSRA |= _BV(ADSC);
+}
+
+void startPotScanner() {
+  /* Start converting and wait until every pot has a reading */
+  // prescaler 128: 125 kHz ADC clock, 104 us per conversion
+  ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+  pot_cur = 0;
+  startPotConversion();
+  while (pot_rounds == 0) {
+    delay(1);
+  }
+}
+
+ISR(ADC_vect) {
+  unsigned int reading = ADC;
+  unsigned int filtered = pot_filtered[pot_cur];
+  if (pot_rounds == 0) {
+    filtered = reading * 4;
+  }
+  else {
+    // exponential moving average, 1/4 of the new reading
+    filtered = filtered - (filtered >> 2) + reading;
+  }
+  pot_filtered[pot_cur] = filtered;
+  // 7 bit level with a hysteresis of one reading step, so a pot resting
+  // between two levels does not flap
+  int smoothed = filtered >> 2;
+  int center = pot_levels[pot_cur] * 8 + 4;
+  if (pot_rounds == 0 || smoothed - center > 4 || center - smoothed > 4) {
+    pot_levels[pot_cur] = smoothed >> 3;
+  }
+  if (++pot_cur == pot_count) {
+    pot_cur = 0;
+    if (pot_rounds < 255) pot_rounds++;
+  }
+  startPotConversion();
+}
+
+int getPotReading(unsigned char pot) {
+  /* Smoothed reading of a pot, 0 to 1023 */
+  noInterrupts();
+  unsigned int filtered = pot_filtered[pot];
+  interrupts();
+  return filtered >> 2;
+}
+
+void computeClock() {
+  /*
+   * MIDI clock master, called by the step timer interrupt before the
+   * notes of a tick. The clock runs all the time, Start/Continue and
+   * Song Position follow the mute switch and always fall on a sixteenth
+   * note, the unit of the Song Position Pointer.
+   */
+  if (slave) {
+    // the clock comes from outside
+    return;
+  }
+  if (step_counter % clock_ticks == 0) {
+    if (step_counter % position_ticks == 0) {
+      if (clock_state == CLOCK_POSITION) {
+        // tell where we go on, one sixteenth ahead
+        long next = step_counter + position_ticks;
+        if (next > wrap_ticks - 1) next = 0;
+        if (next != 0) {
+          unsigned int position = next / position_ticks % position_count;
+          const unsigned char msg[] = {
+            SONG_POSITION,
+            (unsigned char) (position & 0x7f),
+            (unsigned char) (position >> 7)
+          };
+          for (int port=0;port<MIDI_PORT_COUNT;port++) {
+            queueMIDI(port, msg, 3);
+          }
+        }
+        clock_state = CLOCK_CONTINUE;
+      }
+      else if (clock_state == CLOCK_CONTINUE) {
+        sendRealtimeMIDI(step_counter == 0 ? START : CONTINUE);
+        clock_state = CLOCK_RUNNING;
+      }
+    }
+    sendRealtimeMIDI(TIMING_CLOCK);
+  }
+}
+
+void startClock() {
+  /* Go on playing at the position of the step counter */
+  noInterrupts();
+  if (!slave) {
+    // also after an external Stop
+    ext_running = true;
+  }
+  if (clock_state == CLOCK_STOPPED) {
+    clock_state = CLOCK_POSITION;
+  }
+  interrupts();
+}
+
+void stopClock() {
+  noInterrupts();
+  if (clock_state != CLOCK_STOPPED) {
+    clock_state = CLOCK_STOPPED;
+    sendRealtimeMIDI(STOP);
+  }
+  interrupts();
+}
+
+long getStepCounter() {
+  noInterrupts();
+  long step = step_counter;
+  interrupts();
+  return step;
+}
+
+const RhythmCollection* getCollection(int instr, int layer, int m) {
+  /* Rhythms (layer 0) or breaks (layer 1) of instr for mode m */
+  const Instrument* in = &instrs[instr];
+  const RhythmCollection* collections = (const RhythmCollection*)
+    pgm_read_ptr(layer == 0 ? &in->rhythms : &in->breaks);
+  return &collections[m];
+}
+
+int getRhythmCount(const RhythmCollection* collection) {
+  return pgm_read_byte(&collection->rhythm_count);
+}
+
+const Rhythm* getRhythm(const RhythmCollection* collection, int index) {
+  /* Rhythm number index of collection. Points to flash. */
+  const Rhythm* const* rhythms = (const Rhythm* const*)
+    pgm_read_ptr(&collection->rhythms);
+  return (const Rhythm*) pgm_read_ptr(&rhythms[index]);
+}
+
+void printRhythmName(int instr, int layer) {
+  /* Name of the selected rhythm or break of instr */
+  const RhythmCollection* c = getCollection(instr, layer, mode);
+  int choice = instr_states[instr].cur_rhythms[layer][mode];
+  int slot = getChoiceSlot(instr, layer, mode, choice);
+  if (slot < 0) {
+    // rhythm names are read from flash, a deleted pattern plays the first
+    int index = choice < getRhythmCount(c) ? choice : 0;
+    lcd.print((const __FlashStringHelper*) getRhythm(c, index)->name);
+    return;
+  }
+  int pos = getPatternPos(slot) + sizeof(PatternHeader) - RHYTHM_NAME_SIZE;
+  for (int i=0;i<RHYTHM_NAME_SIZE;i++) {
+    char ch = EEPROM.read(pos + i);
+    if (ch == 0) {
+      break;
+    }
+    lcd.print(ch);
+  }
+}
+
+void compileChoice(int instr, int layer, int m, int choice, Schedule* s,
+                   long step) {
+  /*
+   * Compile the rhythm or break choice (see cur_rhythms) of instr for
+   * mode m. User patterns are read from EEPROM, which must not be busy
+   * writing if interrupts are disabled.
+   */
+  const RhythmCollection* c = getCollection(instr, layer, m);
+  int slot = getChoiceSlot(instr, layer, m, choice);
+  Rhythm r;
+  if (slot < 0) {
+    // a deleted pattern plays the first rhythm
+    int index = choice < getRhythmCount(c) ? choice : 0;
+    memcpy_P(&r, getRhythm(c, index), sizeof(Rhythm));
+    compileRhythm(r, -1, s, step, m);
+    return;
+  }
+  int pos = getPatternPos(slot);
+  PatternHeader h;
+  unsigned char* bytes = (unsigned char*) &h;
+  for (unsigned int i=0;i<sizeof(PatternHeader);i++) {
+    bytes[i] = EEPROM.read(pos + i);
+  }
+  r.numerator = h.numerator;
+  r.denominator = h.denominator;
+  r.subdivision = h.subdivision;
+  r.note_count = h.note_count;
+  compileRhythm(r, pos + sizeof(PatternHeader), s, step, m);
+}
+
+void compileRhythm(const Rhythm& r, int notes_pos, Schedule* s, long step,
+                   int m) {
+  /*
+   * Place every note of r on its tick, moved and scaled by the swing and
+   * groove of mode m, to be played from step on. The notes are in EEPROM
+   * at notes_pos, or in flash if notes_pos is -1. Interrupts must be
+   * disabled if the step interrupt plays s.
+   */
+  const unsigned int whole = 4 * subdivision;
+  s->event_count = 0;
+  s->length = 0;
+  s->pos = 0;
+  s->next = 0;
+  s->bar = whole;
+  s->beats = 4;
+  if (r.numerator == 0 || r.denominator == 0 || r.subdivision == 0
+      || r.note_count == 0) {
+    return;
+  }
+  s->bar = (unsigned long) whole * r.numerator / r.denominator;
+  s->beats = r.numerator;
+  // ticks per note. An odd subdivision (quintuplets...) does not fit into
+  // the ticks: the remainder is accumulated and stretches a note by one
+  // tick whenever it overflows, like the step timer.
+  unsigned int stride = whole / r.subdivision;
+  unsigned int stride_remainder = whole % r.subdivision;
+  unsigned int accumulator = 0;
+  // the rhythm repeats after whole bars of its time signature
+  unsigned int span = ((unsigned long) whole * r.note_count
+                       + r.subdivision - 1) / r.subdivision;
+  unsigned int length = (span + s->bar - 1) / s->bar * s->bar;
+  const Groove* groove = &grooves[mode_feels[m].groove];
+  // offset of the offbeat eighth
+  int swing = (mode_feels[m].swing * subdivision + 50) / 100
+    - subdivision / 2;
+  unsigned int tick = 0;
+  for (int n=0;n<r.note_count;n++) {
+    unsigned char velocity = notes_pos < 0 ? pgm_read_byte(&r.notes[n])
+      : EEPROM.read(notes_pos + n);
+    unsigned int note_tick = tick;
+    tick += stride;
+    accumulator += stride_remainder;
+    if (accumulator >= r.subdivision) {
+      accumulator -= r.subdivision;
+      tick++;
+    }
+    if (velocity == 0) {
+      continue;
+    }
+    int offset = 0;
+    if (note_tick % (subdivision / 4) == 0) {
+      // on a sixteenth: the groove applies, from the start of the bar
+      int step16 = (note_tick % s->bar / (subdivision / 4)) % GROOVE_STEPS;
+      offset = (signed char) pgm_read_byte(&groove->offsets[step16]);
+      int level = pgm_read_byte(&groove->levels[step16]);
+      int scaled = (velocity * level) >> 7;
+      velocity = scaled > 0x7f ? 0x7f : (scaled < 1 ? 1 : scaled);
+    }
+    if (note_tick % subdivision == subdivision / 2) {
+      offset += swing;
+    }
+    // moved notes may pass each other and the end of the rhythm; in
+    // long, as length alone may come close to the 16 bit limit
+    insertEvent(s, ((long) note_tick + length + offset) % length, velocity);
+  }
+  s->length = length;
+  seekSchedule(s, step);
+}
+
+void insertEvent(Schedule* s, unsigned int tick, unsigned char velocity) {
+  /* Add a note to s, keeping the events sorted. Dropped when s is full. */
+  int e = s->event_count;
+  while (e > 0 && s->events[e - 1].tick > tick) {
+    e--;
+  }
+  if (e > 0 && s->events[e - 1].tick == tick) {
+    // one event per tick: the louder note wins
+    if (s->events[e - 1].velocity < velocity) {
+      s->events[e - 1].velocity = velocity;
+    }
+    return;
+  }
+  if (s->event_count == SCHEDULE_MAX_EVENTS) {
+    return;
+  }
+  for (int i=s->event_count;i>e;i--) {
+    s->events[i] = s->events[i - 1];
+  }
+  s->events[e].tick = tick;
+  s->events[e].velocity = velocity;
+  s->event_count++;
+}
+
+void seekSchedule(Schedule* s, long step) {
+  /*
+   * Continue a schedule at step, the rhythms count from bar_start. Must
+   * be called with interrupts disabled.
+   */
+  if (s->length == 0) {
+    return;
+  }
+  s->pos = getBarStep(step) % s->length;
+  s->next = 0;
+  while (s->next < s->event_count && s->events[s->next].tick < s->pos) {
+    s->next++;
+  }
+  if (s->next == s->event_count) s->next = 0;
+}
+
+void seekVoices(long step) {
+  // the step counter may jump past cue_step and swap_step
+  if (cue_step >= 0) {
+    swapCues();
+  }
+  if (swap_step >= 0) {
+    swapSchedules();
+  }
+  for (int i=0;i<instrument_count;i++) {
+    for (int l=0;l<2;l++) {
+      seekSchedule(voices[i].layers[l], step);
+    }
+  }
+}
+
+void updateMeter() {
+  /*
+   * Take the time signature of the lead rhythm. When it changes, the bars
+   * start again with the next beat, so the beats go on, and so do all
+   * rhythms. Interrupts must be disabled.
+   */
+  const Schedule* lead = voices[0].layers[0];
+  for (int i=0;i<instrument_count;i++) {
+    if (voices[i].layers[0]->event_count > 0) {
+      lead = voices[i].layers[0];
+      break;
+    }
+  }
+  if (lead->bar == bar_ticks && lead->beats == bar_beats) {
+    return;
+  }
+  long step = getBarStep(step_counter);
+  step = (step + beat_ticks - 1) / beat_ticks * beat_ticks;
+  bar_start = (bar_start + step) % wrap_ticks;
+  bar_ticks = lead->bar;
+  bar_beats = lead->beats;
+  beat_ticks = bar_ticks / bar_beats;
+  // up to the next beat they play the end of their bar
+  seekVoices(step_counter);
+}
+
+long getBarStep(long step) {
+  /* Ticks from the start of the bars to step, within one wrap */
+  unsigned char sreg = SREG;
+  cli();
+  long start = bar_start;
+  SREG = sreg;
+  long bar_step = (step - start) % wrap_ticks;
+  return bar_step < 0 ? bar_step + wrap_ticks : bar_step;
+}
+
+unsigned int getBarTicks() {
+  unsigned char sreg = SREG;
+  cli();
+  unsigned int ticks = bar_ticks;
+  SREG = sreg;
+  return ticks;
+}
+
+unsigned int getBeatTicks() {
+  unsigned char sreg = SREG;
+  cli();
+  unsigned int ticks = beat_ticks;
+  SREG = sreg;
+  return ticks;
+}
+
+void loadRhythm(int instr, int layer) {
+  /*
+   * Compile the selected rhythm (layer 0) or break (layer 1) of instr and
+   * play it from the current step on
+   */
+  // a fill is built from the rhythms and plays in the break layer
+  cancelFill();
+  Voice& voice = voices[instr];
+  // a selection still waiting is outdated, take its cue schedule back
+  noInterrupts();
+  voice.cued &= ~_BV(layer);
+  long step = step_counter;
+  interrupts();
+  // compiled aside, reading a user pattern may wait for an EEPROM write
+  int choice = instr_states[instr].cur_rhythms[layer][mode];
+  compileChoice(instr, layer, mode, choice, voice.cue[layer], step);
+  noInterrupts();
+  Schedule* s = voice.layers[layer];
+  voice.layers[layer] = voice.cue[layer];
+  voice.cue[layer] = s;
+  // ticks went by while compiling
+  seekSchedule(voice.layers[layer], step_counter);
+  updateMeter();
+  interrupts();
+}
+
+void cueRhythm(int instr, int layer) {
+  /*
+   * Compile the selected rhythm (layer 0) or break (layer 1) of instr
+   * into its cue schedule, the step interrupt swaps it in at the next
+   * quantize boundary
+   */
+  // a fill is built from the rhythms and plays in the break layer
+  cancelFill();
+  Voice& voice = voices[instr];
+  // take the cue schedule back if an older selection waits in it
+  noInterrupts();
+  voice.cued &= ~_BV(layer);
+  long step = step_counter;
+  interrupts();
+  int choice = instr_states[instr].cur_rhythms[layer][mode];
+  compileChoice(instr, layer, mode, choice, voice.cue[layer], step);
+  // the boundary may have passed while compiling
+  noInterrupts();
+  cue_step = getCueStep();
+  seekSchedule(voice.cue[layer], cue_step);
+  voice.cued |= _BV(layer);
+  interrupts();
+}
+
+void cueBreak(boolean on) {
+  /* Switch the breaks on or off at the next quantize boundary */
+  noInterrupts();
+  cued_break = on;
+  break_cued = true;
+  cue_step = getCueStep();
+  interrupts();
+}
+
+long getCueStep() {
+  /*
+   * The step everything cued swaps at: the one already set or the next
+   * quantize boundary, which may be the tick played next. Interrupts
+   * must be disabled.
+   */
+  if (cue_step >= 0) {
+    return cue_step;
+  }
+  long quantum = 1;
+  if (getQuantize() == QUANTIZE_BAR) {
+    quantum = bar_ticks;
+  }
+  else if (getQuantize() == QUANTIZE_BEAT) {
+    quantum = beat_ticks;
+  }
+  long step = getBarStep(step_counter);
+  step = (step + quantum - 1) / quantum * quantum;
+  return (step + bar_start) % wrap_ticks;
+}
+
+void swapCues() {
+  /* Start what is cued. Interrupts must be disabled. */
+  for (int i=0;i<instrument_count;i++) {
+    Voice& voice = voices[i];
+    for (int l=0;l<2;l++) {
+      if (voice.cued & _BV(l)) {
+        Schedule* s = voice.layers[l];
+        voice.layers[l] = voice.cue[l];
+        voice.cue[l] = s;
+      }
+    }
+    voice.cued = 0;
+  }
+  if (break_cued) {
+    is_break = cued_break;
+    break_cued = false;
+  }
+  cue_step = -1;
+  updateMeter();
+}
+
+void selectRhythm(int instr, int layer, int delta) {
+  /* Move the selection of instr by delta, wrapping around, and save it */
+  int count = getChoiceCount(instr, layer, mode);
+  if (count < 2) {
+    return;
+  }
+  int cur = getChoiceNumber(instr, layer, mode,
+                            instr_states[instr].cur_rhythms[layer][mode]);
+  setRhythm(instr, layer, getChoice(instr, layer, mode,
+                                    (cur + count + delta) % count));
+}
+
+void setRhythm(int instr, int layer, int choice) {
+  /*
+   * Select choice (see cur_rhythms) for instr in the current mode and
+   * save it. It plays from the next quantize boundary on.
+   */
+  instr_states[instr].cur_rhythms[layer][mode] = choice;
+  cueRhythm(instr, layer);
+  saveInstrument(instr);
+}
+
+void queueRhythm(int instr, int layer, int index) {
+  /* Select a rhythm received over MIDI, if there is one at index */
+  if (index >= getChoiceCount(instr, layer, mode)) {
+    return;
+  }
+  setRhythm(instr, layer, getChoice(instr, layer, mode, index));
+  cur_view->updateDisplay();
+}
+
+void startSong(int song) {
+  /* Play song from the next bar on */
+  cancelFill();
+  cur_song = song;
+  song_saved_mode = mode;
+  song_entry = 0;
+  song_current = -1;
+  long step = getStepCounter();
+  long bar = getBarTicks();
+  prepareSongEntry(step + bar - getBarStep(step) % bar);
+  song_playing = true;
+}
+
+void stopSong() {
+  /* Go back to the mode and rhythms selected before the song */
+  noInterrupts();
+  swap_step = -1;
+  song_break = false;
+  interrupts();
+  song_playing = false;
+  if (mode != song_saved_mode) {
+    setMode(song_saved_mode);
+  }
+  else {
+    updateRhythms();
+  }
+}
+
+void prepareSongEntry(long start) {
+  /*
+   * Compile the current song entry into the standby schedules and let
+   * the step interrupt swap them in at start, which may lie after one or
+   * more wraps of the step counter.
+   */
+  const Song* song = &songs[cur_song];
+  const SongEntry* entries = (const SongEntry*) pgm_read_ptr(&song->entries);
+  SongEntry e;
+  memcpy_P(&e, &entries[song_entry], sizeof(SongEntry));
+  for (int i=0;i<instrument_count;i++) {
+    for (int l=0;l<2;l++) {
+      int index = l == 0 ? e.rhythms[i] : instr_states[i].cur_rhythms[1][e.mode];
+      // standby schedules are not played, no need to stop interrupts;
+      // an index out of range plays the first rhythm
+      compileChoice(i, l, e.mode, index, voices[i].standby[l],
+                    start % wrap_ticks);
+    }
+  }
+  noInterrupts();
+  swap_mode = e.mode;
+  swap_break = e.is_break;
+  swap_wraps = start / wrap_ticks;
+  swap_step = start % wrap_ticks;
+  interrupts();
+}
+
+void computeSong() {
+  /* Prepare the next entry as soon as the one before has been swapped in */
+  if (!song_playing) {
+    return;
+  }
+  noInterrupts();
+  long pending = swap_step;
+  long start = last_swap_step;
+  interrupts();
+  if (pending >= 0) {
+    return;
+  }
+  // the playing entry ends after its bars
+  const Song* song = &songs[cur_song];
+  const SongEntry* entries = (const SongEntry*) pgm_read_ptr(&song->entries);
+  unsigned char bars = pgm_read_byte(&entries[song_entry].bars);
+  start += (long) bars * getBarTicks();
+  song_current = song_entry;
+  if (++song_entry == pgm_read_byte(&song->entry_count)) {
+    song_entry = 0;
+  }
+  prepareSongEntry(start);
+  cur_view->updateDisplay();
+}
+
+void swapSchedules() {
+  /* Start the prepared song entry. Interrupts must be disabled. */
+  for (int i=0;i<instrument_count;i++) {
+    for (int l=0;l<2;l++) {
+      Schedule* s = voices[i].layers[l];
+      voices[i].layers[l] = voices[i].standby[l];
+      voices[i].standby[l] = s;
+    }
+  }
+  mode = swap_mode;
+  song_break = swap_break;
+  last_swap_step = step_counter;
+  swap_step = -1;
+  updateMeter();
+}
+
+void buildFill(int instr, long start) {
+  /*
+   * Build the fill of instr for the bar from step start into its standby
+   * break schedule, out of the rhythm it plays.
+   */
+  // the step interrupt only moves pos and next of the rhythm
+  const Schedule* rhythm = voices[instr].layers[0];
+  Schedule* fill = voices[instr].standby[1];
+  unsigned int bar = getBarTicks();
+  unsigned int beat = getBeatTicks();
+  unsigned char role = pgm_read_byte(&instrs[instr].fill);
+  // a roll takes the place of the rhythm in the last two beats, or the
+  // whole bar if it has fewer
+  unsigned int roll = bar;
+  if (role == FILL_ROLL) {
+    roll = bar > 2 * beat ? bar - 2 * beat : 0;
+  }
+  fill->event_count = 0;
+  fill->length = bar;
+  fill->pos = 0;
+  fill->next = 0;
+  fill->bar = bar;
+  fill->beats = bar_beats;
+  if (rhythm->length > 0) {
+    unsigned int offset = start % rhythm->length;
+    for (int e=0;e<rhythm->event_count;e++) {
+      long tick = (long) rhythm->events[e].tick - offset;
+      if (tick < 0) tick += rhythm->length;
+      for (;tick<roll;tick+=rhythm->length) {
+        insertEvent(fill, tick, rhythm->events[e].velocity);
+      }
+    }
+  }
+  if (role == FILL_DENSER) {
+    // split the gaps of an eighth or more in the second half, louder
+    // towards the end. Backwards, so the inserts do not move the events
+    // still to look at.
+    unsigned int next = bar;
+    for (int e=fill->event_count-1;e>=0;e--) {
+      unsigned int tick = fill->events[e].tick;
+      if (tick < bar / 2) {
+        break;
+      }
+      if (next - tick >= subdivision / 2) {
+        unsigned int middle = (tick + next) / 2;
+        insertEvent(fill, middle, 48 + (unsigned long) 79 * middle / bar);
+      }
+      next = tick;
+    }
+  }
+  else if (role == FILL_ROLL) {
+    // halves of a beat on the second last beat, quarters on the last one
+    for (unsigned int tick=roll;tick<bar;) {
+      insertEvent(fill, tick,
+                  56 + (unsigned long) 64 * (tick - roll) / (2 * beat));
+      unsigned int step = tick < bar - beat ? beat / 2 : beat / 4;
+      // at least a tick, beats may be shorter than four
+      tick += step > 0 ? step : 1;
+    }
+  }
+}
+
+void computeFill() {
+  /*
+   * Build the fill in the bar before the last one of a phrase, one
+   * instrument per call, and drop it when the step counter jumped past it.
+   */
+  if (fill_bars == 0 || song_playing) {
+    return;
+  }
+  if (fill_state == FILL_IDLE && cue_step >= 0) {
+    // the cue swap must not meet a fill in the break layer
+    return;
+  }
+  // in ticks from bar_start
+  long bar_ticks = getBarTicks();
+  long fill_bar = fill_start / bar_ticks;
+  long bar = getBarStep(getStepCounter()) / bar_ticks;
+  switch (fill_state) {
+  case FILL_IDLE:
+    if ((bar + 2) % fill_bars == 0) {
+      // the phrases fit into a wrap, a fill never wraps
+      fill_start = (bar + 1) * bar_ticks;
+      fill_instr = 0;
+      fill_state = FILL_BUILDING;
+    }
+    break;
+  case FILL_BUILDING:
+    if (bar != fill_bar - 1) {
+      // too late, maybe the next phrase
+      fill_state = FILL_IDLE;
+      break;
+    }
+    buildFill(fill_instr, fill_start);
+    if (++fill_instr == instrument_count) {
+      noInterrupts();
+      fill_step = (bar_start + fill_start) % wrap_ticks;
+      fill_state = FILL_ARMED;
+      interrupts();
+    }
+    break;
+  default:
+    // armed or playing: the step interrupt goes on at fill_step
+    noInterrupts();
+    long step = getBarStep(step_counter);
+    bar = step / bar_ticks;
+    if (step != getBarStep(fill_step)
+        && bar != (fill_state == FILL_ARMED ? fill_bar - 1 : fill_bar)) {
+      cancelFill();
+    }
+    interrupts();
+    break;
+  }
+}
+
+void swapFill() {
+  /* Exchange the breaks and the fill. Interrupts must be disabled. */
+  for (int i=0;i<instrument_count;i++) {
+    Schedule* s = voices[i].layers[1];
+    voices[i].layers[1] = voices[i].standby[1];
+    voices[i].standby[1] = s;
+    seekSchedule(voices[i].layers[1], step_counter);
+  }
+}
+
+void startFill() {
+  /* Runs in the step timer interrupt */
+  swapFill();
+  fill_state = FILL_PLAYING;
+  fill_step = (step_counter + bar_ticks) % wrap_ticks;
+}
+
+void endFill() {
+  /* Runs in the step timer interrupt */
+  swapFill();
+  fill_state = FILL_IDLE;
+  fill_step = -1;
+  playCrash();
+}
+
+void playCrash() {
+  /* Crash on the downbeat after a fill. Runs in the step interrupt. */
+  if (muted || vol == 0) {
+    return;
+  }
+  unsigned long due = micros();
+  unsigned char slot = wheel_tick & (NOTE_WHEEL_SIZE - 1);
+  for (int i=0;i<instrument_count;i++) {
+    if (pgm_read_byte(&instrs[i].fill) != FILL_CRASH) {
+      continue;
     }
-    pre_last_bpm = last_bpm;
-    last_bpm = bpm;
+    Schedule& s = *voices[i].layers[0];
+    if (s.event_count > 0 && s.events[s.next].tick == s.pos) {
+      // its rhythm plays the downbeat anyway
+      continue;
+    }
+    int note_vol = scaleVelocity(fill_crash_velocity,
+                                 levelToGain(pot_levels[voices[i].pot]));
+    if (note_vol > 0) {
+      startNote(i, pgm_read_byte(&voices[i].curve[note_vol]), due, slot);
+    }
+  }
+}
+
+void cancelFill() {
+  /* Drop the fill, back to the breaks if it plays */
+  unsigned char sreg = SREG;
+  cli();
+  if (fill_state == FILL_PLAYING) {
+    swapFill();
+  }
+  fill_state = FILL_IDLE;
+  fill_step = -1;
+  SREG = sreg;
+}
+
+void updateRhythms() {
+  for (int i=0;i<instrument_count;i++) {
+    loadRhythm(i, 0);
+    loadRhythm(i, 1);
+  }
+}
+
+void cueRhythms() {
+  for (int i=0;i<instrument_count;i++) {
+    cueRhythm(i, 0);
+    cueRhythm(i, 1);
+  }
+}
+
+/* Getter and setter (for the settings) */
+int getMode() {
+  if (settings.mode < mode_count) {
+    return settings.mode;
+  }
+  return 0;
+}
+
+void setMode(int new_mode) {
+  if (song_playing) {
+    // choosing a mode ends the song
+    stopSong();
+  }
+  if (mode != new_mode) {
+    mode = new_mode;
+    flushNotes();
+    settings.mode = mode;
+    markSettingsDirty();
+    updateRhythms();
+  }
+}
+
+int getQuantize() {
+  if (settings.quantize < quantize_count) {
+    return settings.quantize;
+  }
+  return QUANTIZE_BAR;
+}
+
+void setQuantize(int quantize) {
+  if (settings.quantize != quantize) {
+    settings.quantize = quantize;
+    markSettingsDirty();
+  }
+}
+
+void setHumanize(boolean on, uint16_t seed) {
+  humanize = on;
+  humanize_seed = seed;
+  if (settings.humanize != on || settings.humanize_seed != seed) {
+    settings.humanize = on;
+    settings.humanize_seed = seed;
+    markSettingsDirty();
+  }
+}
+
+void saveInstrument(int uid) {
+  /* Keep the current rhythms and breaks of every mode of uid */
+  if (memcmp(settings.rhythms[uid], instr_states[uid].cur_rhythms,
+             sizeof(settings.rhythms[uid])) != 0) {
+    memcpy(settings.rhythms[uid], instr_states[uid].cur_rhythms,
+           sizeof(settings.rhythms[uid]));
+    markSettingsDirty();
+  }
+}
+
+void restoreInstrument(int uid) {
+  for (int l=0;l<2;l++) {
+    // rhythms, then breaks
+    for (int i=0;i<mode_count;i++) {
+      unsigned char& cur = instr_states[uid].cur_rhythms[l][i];
+      cur = settings.rhythms[uid][l][i];
+      if (getChoice(uid, l, i, getChoiceNumber(uid, l, i, cur)) != cur) {
+        // a user pattern that is gone, or a rhythm out of range
+        cur = 0;
+      }
+    }
+    loadRhythm(uid, l);
+  }
+  saveInstrument(uid);
+  setCurve(uid, settings.curves[uid] < curve_count ? settings.curves[uid] : 0);
+}
+
+void saveFeel(int m) {
+  /* Keep the swing and groove of mode m */
+  if (memcmp(&settings.feels[m], &mode_feels[m], sizeof(ModeFeel)) != 0) {
+    settings.feels[m] = mode_feels[m];
+    markSettingsDirty();
+  }
+}
+
+void restoreFeel(int m) {
+  const ModeFeel& feel = settings.feels[m];
+  if (feel.swing >= 50 && feel.swing <= 75 && feel.groove < groove_count) {
+    mode_feels[m] = feel;
+  }
+  saveFeel(m);
+}
+
+void setCurve(int uid, int curve) {
+  /* Select velocity curve number curve for uid and save it */
+  // a pointer is written at once, the step interrupt may read it any time
+  const unsigned char* levels = velocity_curves[curve].levels;
+  noInterrupts();
+  voices[uid].curve = levels;
+  interrupts();
+  if (settings.curves[uid] != curve) {
+    settings.curves[uid] = curve;
+    markSettingsDirty();
+  }
+}
+
+void loadSettings() {
+  /* Read the newest valid record of the settings log */
+  settings_slot = -1;
+  unsigned char record[SETTINGS_SLOT_SIZE];
+  for (int slot=0;slot<SETTINGS_SLOT_COUNT;slot++) {
+    int pos = settings_pos + slot * SETTINGS_SLOT_SIZE;
+    uint16_t crc = 0xffff;
+    for (unsigned int i=0;i<sizeof(Settings) + 3;i++) {
+      record[i] = EEPROM.read(pos + i);
+      if (i < sizeof(Settings) + 1) {
+        crc = updateCRC(crc, record[i]);
+      }
+    }
+    if (record[1] != SETTINGS_VERSION
+        || record[sizeof(Settings) + 1] != (crc & 0xff)
+        || record[sizeof(Settings) + 2] != crc >> 8) {
+      continue;
+    }
+    // sequence numbers wrap, the ones in the ring lie close together
+    if (settings_slot >= 0
+        && (unsigned char) (record[0] - settings_seq) >= 0x80) {
+      continue;
+    }
+    settings_slot = slot;
+    settings_seq = record[0];
+    memcpy(&settings, &record[1], sizeof(Settings));
+  }
+  if (settings_slot < 0) {
+    migrateSettings();
+  }
+}
+
+void migrateSettings() {
+  /*
+   * Take the settings over from the legacy layout, or the defaults from
+   * an empty EEPROM, and write them to the first slot of the log
+   */
+  resetSettings();
+  settings.version = SETTINGS_VERSION;
+  settings.mode = EEPROM.read(mode_pos);
+  for (int uid=0;uid<instrument_count;uid++) {
+    int pos = instruments_pos + uid * INSTR_STORE_MAX_SIZE;
+    if (EEPROM.read(pos) != uid) {
+      // never saved
+      continue;
+    }
+    for (int l=0;l<2;l++) {
+      for (int i=0;i<mode_count;i++) {
+        settings.rhythms[uid][l][i] = EEPROM.read(pos + 1 + l * MAX_MODES + i);
+      }
+    }
+  }
+  settings_slot = SETTINGS_SLOT_COUNT - 1;
+  settings_seq = 0xff;
+  markSettingsDirty();
+}
+
+void resetSettings() {
+  /* The defaults of all settings */
+  memset(&settings, 0, sizeof(Settings));
+  settings.humanize_seed = default_seed;
+  memcpy(settings.feels, mode_feels, sizeof(settings.feels));
+}
+
+void markSettingsDirty() {
+  settings_dirty = true;
+  settings_changed = millis();
+}
+
+void computeSettingsStore() {
+  /*
+   * Write the settings to the next slot of the log once they stopped
+   * changing. One byte per call, and only when the EEPROM is not busy,
+   * so loop() never waits. A change while writing is written as well,
+   * or by the next flush; the CRC covers what was written.
+   */
+  if (settings_write_pos < 0) {
+    if (!settings_dirty || millis() - settings_changed < SETTINGS_QUIET_MS) {
+      return;
+    }
+    settings_dirty = false;
+    settings_write_slot = (settings_slot + 1) % SETTINGS_SLOT_COUNT;
+    settings_write_pos = 0;
+    settings_crc = 0xffff;
+  }
+  if (!eeprom_is_ready()) {
+    return;
+  }
+  int pos = settings_pos + settings_write_slot * SETTINGS_SLOT_SIZE;
+  const unsigned char* bytes = (const unsigned char*) &settings;
+  int crc_pos = sizeof(Settings) + 1;
+  while (settings_write_pos < crc_pos + 2) {
+    int i = settings_write_pos++;
+    unsigned char data;
+    if (i == 0) {
+      data = settings_seq + 1;
+    }
+    else if (i < crc_pos) {
+      data = bytes[i - 1];
+    }
+    else {
+      data = i == crc_pos ? settings_crc & 0xff : settings_crc >> 8;
+    }
+    if (i < crc_pos) {
+      settings_crc = updateCRC(settings_crc, data);
+    }
+    if (EEPROM.read(pos + i) != data) {
+      EEPROM.write(pos + i, data);
+      return;
+    }
+  }
+  settings_write_pos = -1;
+  settings_slot = settings_write_slot;
+  settings_seq++;
+}
+
+
+void setup() {
+  pinMode(up_pin, INPUT_PULLUP);
+  pinMode(down_pin, INPUT_PULLUP);
+  pinMode(left_pin, INPUT_PULLUP);
+  pinMode(right_pin, INPUT_PULLUP);
+  pinMode(enter_pin, INPUT_PULLUP);
+
+  pinMode(break_pin, INPUT_PULLUP);
+  pinMode(mute_switch_pin, INPUT_PULLUP);
+
+  pinMode(metronome_pin, OUTPUT);
+
+  lcd.begin();
+  lcd.print("Setup");
+  lcd.refresh(LCD_COLS * LCD_ROWS);
+  beginMIDI();
+  step_counter = 0;
+
+  // Read EEPROM content
+  loadPatternIndex();
+  loadSettings();
+  mode = getMode();
+  humanize = settings.humanize;
+  humanize_seed = settings.humanize_seed;
+  if (settings.fill_bars == 4 || settings.fill_bars == 8) {
+    fill_bars = settings.fill_bars;
+  }
+  // before the rhythms, they are compiled with the feels
+  for (int i=0;i<mode_count;i++) {
+    restoreFeel(i);
+  }
+  bpm_pot = addPot(bmp_pin);
+  pitch_pot = addPot(pitch_pin);
+  vol_pot = addPot(vol_pin);
+  // the meter looks at the rhythms of all voices
+  for (int i=0;i<instrument_count;i++) {
+    for (int l=0;l<2;l++) {
+      voices[i].layers[l] = &voices[i].schedules[l];
+      voices[i].standby[l] = &voices[i].schedules[2 + l];
+      voices[i].cue[l] = &voices[i].schedules[4 + l];
+    }
+  }
+  for (int i=0;i<instrument_count;i++) {
+    voices[i].midi_note = pgm_read_byte(&instrs[i].midi_note);
+    voices[i].pot = addPot(pgm_read_byte(&instrs[i].input_pin));
+    voices[i].gate = pgm_read_byte(&instrs[i].gate);
+    voices[i].off_slot = NO_NOTE_OFF;
+    voices[i].probability = pgm_read_byte(&instrs[i].probability);
+    voices[i].velocity_spread = pgm_read_byte(&instrs[i].velocity_spread);
+    voices[i].timing_spread = pgm_read_byte(&instrs[i].timing_spread);
+    voices[i].delay_slot = NO_NOTE_OFF;
+    restoreInstrument(i);
   }
-  pitch = map(analogRead(pitch_pin), 0, 1023, 0, 0x7f);
-  if (pitch != last_pitch) {
-    if (pre_last_pitch != pitch) {
-      sendMIDI(PITCH_BEND_CHANGE | drum_channel, 0, pitch);
+  startButtonScanner();
+  muted = button_state & _BV(BUTTON_MUTE);
+  is_break = button_state & _BV(BUTTON_BREAK);
+  seedRandom(humanize_seed);
+  // play from the start, the first tick sends Start
+  clock_state = muted ? CLOCK_STOPPED : CLOCK_CONTINUE;
+
+  startPotScanner();
+  bpm = map(getPotReading(bpm_pot), 0, 1023, 10, 220);
+  setTempo(bpm);
+  startStepTimer();
+}
+
+
+void loop() {
+  /*
+   * The steps are played by the timer interrupt. Everything here is
+   * background work, split into short slices so a single pass never takes
+   * long.
+   */
+  computeButtons();
+  switch (loop_slice) {
+  case 0:
+    vol = pot_levels[vol_pot];
+    if (vol != last_vol) {
+      if (pre_last_vol != vol) {
+        sendMIDI(CONTROL_CHANGE | drum_channel, 0x07, vol);
+      }
+      pre_last_vol = last_vol;
+      last_vol = vol;
+    }
+    break;
+  case 1:
+    if (updateSlave()) {
+      bpm = getSlaveTempo();
+      if (bpm != last_bpm) {
+        last_bpm = bpm;
+        cur_view->updateDisplay();
+      }
+      break;
+    }
+    bpm = map(getPotReading(bpm_pot), 0, 1023, 10, 220);
+    if (bpm != last_bpm) {
+      if (pre_last_bpm != bpm) {
+        setTempo(bpm);
+        cur_view->updateDisplay();
+      }
+      pre_last_bpm = last_bpm;
+      last_bpm = bpm;
+    }
+    break;
+  case 2:
+    pitch = pot_levels[pitch_pot];
+    if (pitch != last_pitch) {
+      if (pre_last_pitch != pitch) {
+        sendMIDI(PITCH_BEND_CHANGE | drum_channel, 0, pitch);
+      }
+      pre_last_pitch = last_pitch;
+      last_pitch = pitch;
     }
-    pre_last_pitch = last_pitch;
-    last_pitch = pitch;
+    break;
   }
-  delay(getDelay(millis() - start_millis));
+  if (++loop_slice >= 3) loop_slice = 0;
+  computeMIDIInput();
+  computeSysEx();
+  computeSettingsStore();
+  computeSong();
+  computeFill();
+  displayBeat(getStepCounter(), false);
+  lcd.refresh(LCD_CELLS_PER_PASS);
 }
@@ -0,0 +1,194 @@
+/*
+ Arduino Drum Machine Firmware - host simulation
+ Copyright (C) 2015 Valentin Pratz
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+// Stand-in for the Arduino core. Only what the sketch uses is provided,
+// with the timing of the ATmega2560 modelled in virtual CPU cycles.
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <avr/pgmspace.h>
+
+#define F_CPU 16000000UL
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+// Arduino Mega analog pins
+#define A0 54
+#define A1 55
+#define A2 56
+#define A3 57
+#define A4 58
+#define A5 59
+#define A6 60
+#define A7 61
+#define A8 62
+#define A9 63
+#define A10 64
+#define A11 65
+#define A12 66
+#define A13 67
+#define A14 68
+#define A15 69
+
+#define _BV(bit) (1 << (bit))
+
+void pinMode(uint8_t, uint8_t);
+void digitalWrite(uint8_t, uint8_t);
+int digitalRead(uint8_t);
+int analogRead(uint8_t);
+void analogWrite(uint8_t, int);
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long);
+void delayMicroseconds(unsigned int);
+
+long map(long, long, long, long, long);
+
+// Interrupts. Bit 7 of SREG is the global interrupt flag.
+extern uint8_t SREG;
+void cli(void);
+void sei(void);
+#define noInterrupts() cli()
+#define interrupts() sei()
+#define ISR(vector, ...) extern "C" void vector(void)
+
+// Timer0 keeps running for millis(), only compare match B is modelled
+extern volatile uint8_t TIMSK0;
+extern volatile uint8_t OCR0B;
+#define OCIE0B 2
+
+// Timer1
+extern volatile uint8_t TCCR1A;
+extern volatile uint8_t TCCR1B;
+extern volatile uint8_t TIMSK1;
+class Timer1Count {
+public:
+  Timer1Count& operator=(uint16_t);
+  operator uint16_t() const;
+};
+extern Timer1Count TCNT1;
+extern volatile uint16_t OCR1A;
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define OCIE1A 1
+
+// Input registers of the ports, the pins read as their digital value
+class PortInput {
+public:
+  PortInput(const int8_t* pins): pins(pins) {}
+  operator uint8_t() const;
+private:
+  const int8_t* pins; // digital pin of bit 0 to 7, -1 = none
+};
+extern PortInput PINA;
+extern PortInput PINE;
+extern PortInput PING;
+extern PortInput PINH;
+#define PA0 0
+#define PA1 1
+#define PE3 3
+#define PE4 4
+#define PE5 5
+#define PG5 5
+#define PH3 3
+
+// ADC
+extern volatile uint8_t ADMUX;
+extern volatile uint8_t ADCSRA;
+extern volatile uint8_t ADCSRB;
+extern volatile uint16_t ADC;
+#define REFS0 6
+#define ADEN 7
+#define ADSC 6
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define MUX5 3
+
+// USART0 and USART1, transmit side only
+class UartData {
+public:
+  UartData(int port): port(port) {}
+  UartData& operator=(uint8_t);
+  operator uint8_t() const;
+private:
+  int port;
+};
+extern volatile uint8_t UCSR0A;
+extern volatile uint8_t UCSR0B;
+extern volatile uint8_t UCSR0C;
+extern volatile uint16_t UBRR0;
+extern UartData UDR0;
+extern volatile uint8_t UCSR1A;
+extern volatile uint8_t UCSR1B;
+extern volatile uint8_t UCSR1C;
+extern volatile uint16_t UBRR1;
+extern UartData UDR1;
+#define RXC0 7
+#define U2X0 1
+#define UDRE0 5
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define RXCIE0 7
+#define RXC1 7
+#define U2X1 1
+#define UDRE1 5
+#define TXEN1 3
+#define RXEN1 4
+#define UDRIE1 5
+#define RXCIE1 7
+
+class __FlashStringHelper;
+#define F(string_literal) ((const __FlashStringHelper*) PSTR(string_literal))
+
+class Print {
+public:
+  virtual size_t write(uint8_t) = 0;
+  size_t write(const char* str);
+  size_t print(const __FlashStringHelper*);
+  size_t print(const char*);
+  size_t print(char);
+  size_t print(int, int = 10);
+  size_t print(unsigned int, int = 10);
+  size_t print(long, int = 10);
+  size_t print(unsigned long, int = 10);
+  size_t println(void);
+};
+
+
+#endif
@@ -0,0 +1,33 @@
+/*
+ Arduino Drum Machine Firmware - host simulation
+ Copyright (C) 2015 Valentin Pratz
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+// 4 KB EEPROM of the ATmega2560, 3.3 ms per write
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include "Arduino.h"
+
+class EEPROMClass {
+public:
+  uint8_t read(int);
+  void write(int, uint8_t);
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
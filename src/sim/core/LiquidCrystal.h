@@ -0,0 +1,36 @@
+/*
+ Arduino Drum Machine Firmware - host simulation
+ Copyright (C) 2015 Valentin Pratz
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+// HD44780 stand-in with the command delays of the Arduino library
+#ifndef LiquidCrystal_h
+#define LiquidCrystal_h
+
+#include "Arduino.h"
+
+class LiquidCrystal: public Print {
+public:
+  LiquidCrystal(uint8_t, uint8_t, uint8_t, uint8_t, uint8_t, uint8_t) {}
+  void begin(uint8_t cols, uint8_t rows);
+  void clear();
+  void home();
+  void setCursor(uint8_t, uint8_t);
+  size_t write(uint8_t);
+  using Print::write;
+};
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ Arduino Drum Machine Firmware - host simulation
+ Copyright (C) 2015 Valentin Pratz
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+// The EEPROM status of avr-libc, the data goes through EEPROM.h
+#ifndef _AVR_EEPROM_H_
+#define _AVR_EEPROM_H_
+
+// false while a write is in progress
+bool eeprom_is_ready();
+#define eeprom_busy_wait() do {} while (!eeprom_is_ready())
+
+#endif
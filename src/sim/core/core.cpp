@@ -0,0 +1,562 @@
+/*
+ Arduino Drum Machine Firmware - host simulation
+ Copyright (C) 2015 Valentin Pratz
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "Arduino.h"
+#include "LiquidCrystal.h"
+#include "EEPROM.h"
+#include "avr/eeprom.h"
+#include "sim.h"
+
+#include <algorithm>
+#include <deque>
+
+// interrupt vectors the sketch may define
+extern "C" void TIMER0_COMPB_vect(void) __attribute__((weak));
+extern "C" void TIMER1_COMPA_vect(void) __attribute__((weak));
+extern "C" void USART0_RX_vect(void) __attribute__((weak));
+extern "C" void USART0_UDRE_vect(void) __attribute__((weak));
+extern "C" void USART1_RX_vect(void) __attribute__((weak));
+extern "C" void USART1_UDRE_vect(void) __attribute__((weak));
+extern "C" void ADC_vect(void) __attribute__((weak));
+
+namespace sim {
+
+uint64_t now = 0;
+std::vector<SerialByte> serial_log;
+
+static int analog_values[70];
+static int digital_values[70];
+static bool digital_set[70];
+
+static const uint64_t us = F_CPU / 1000000;
+
+// Timer0: prescaler 64 from reset, compare match B once per overflow
+static const uint64_t timer0_period = 64 * 256;
+static uint64_t timer0_done = 0; // last compare match
+static bool timer0_pending = false;
+
+static uint64_t timer0Next() {
+  uint64_t phase = (uint64_t) OCR0B * 64;
+  if (timer0_done < phase) return phase;
+  return ((timer0_done - phase) / timer0_period + 1) * timer0_period + phase;
+}
+
+// Timer1
+static uint64_t timer1_start = 0;
+static uint16_t timer1_count = 0; // TCNT1 while stopped
+static bool timer1_running = false;
+static bool timer1_pending = false;
+
+static int timer1Prescaler() {
+  switch (TCCR1B & 0x07) {
+  case 1: return 1;
+  case 2: return 8;
+  case 3: return 64;
+  case 4: return 256;
+  case 5: return 1024;
+  }
+  return 0;
+}
+
+static void syncTimer1() {
+  bool running = timer1Prescaler() != 0;
+  if (running && !timer1_running) {
+    timer1_start = now - (uint64_t) timer1_count * timer1Prescaler();
+  }
+  timer1_running = running;
+}
+
+static uint64_t timer1Next() {
+  return timer1_start + (uint64_t) (OCR1A + 1) * timer1Prescaler();
+}
+
+// USARTs: a shift register fed from a one byte data register
+struct Uart {
+  volatile uint8_t* ucsra;
+  volatile uint8_t* ucsrb;
+  volatile uint16_t* ubrr;
+  uint64_t shifter_free; // cycle the stop bit of the current byte ends
+  bool udr_full;
+  uint8_t udr;
+  std::deque<std::pair<uint64_t, uint8_t> > incoming;
+  uint8_t rx_data; // received byte, valid while RXC is set
+};
+static Uart uarts[2] = {
+  {&UCSR0A, &UCSR0B, &UBRR0, 0, false, 0, {}, 0},
+  {&UCSR1A, &UCSR1B, &UBRR1, 0, false, 0, {}, 0}
+};
+
+void receive(int port, uint64_t cycle, uint8_t data) {
+  std::deque<std::pair<uint64_t, uint8_t> >& in = uarts[port].incoming;
+  auto pos = std::upper_bound(
+      in.begin(), in.end(), cycle,
+      [](uint64_t c, const std::pair<uint64_t, uint8_t>& b) {
+        return c < b.first;
+      });
+  in.insert(pos, std::make_pair(cycle, data));
+}
+
+static void uartReceive(int port) {
+  Uart& u = uarts[port];
+  uint8_t data = u.incoming.front().second;
+  u.incoming.pop_front();
+  if (!(*u.ucsrb & _BV(RXEN0))) return;
+  // the hardware buffers two bytes, the model only one: good enough as
+  // long as the sketch reads UDR in its interrupt
+  u.rx_data = data;
+  *u.ucsra |= _BV(RXC0);
+}
+
+static uint8_t uartRead(int port) {
+  Uart& u = uarts[port];
+  *u.ucsra &= ~_BV(RXC0);
+  return u.rx_data;
+}
+
+static bool uartReceivePending(int port) {
+  return (*uarts[port].ucsra & _BV(RXC0)) && (*uarts[port].ucsrb & _BV(RXCIE0));
+}
+
+static uint64_t uartByteCycles(const Uart& u) {
+  // 10 bits per frame, 8 or 16 cycles per bit and baud rate step
+  return 10 * ((*u.ucsra & _BV(U2X0)) ? 8 : 16) * ((uint64_t) *u.ubrr + 1);
+}
+
+static void uartShift(int port, uint8_t data) {
+  Uart& u = uarts[port];
+  serial_log.push_back({now, port, data});
+  u.shifter_free = now + uartByteCycles(u);
+}
+
+static void uartWrite(int port, uint8_t data) {
+  Uart& u = uarts[port];
+  if (!(*u.ucsrb & _BV(TXEN0))) return;
+  if (u.shifter_free <= now && !u.udr_full) {
+    uartShift(port, data);
+  }
+  else {
+    // a write while UDRE is clear is lost on the hardware as well
+    u.udr_full = true;
+    u.udr = data;
+  }
+}
+
+static bool uartEmptyPending(int port) {
+  return !uarts[port].udr_full && (*uarts[port].ucsrb & _BV(UDRIE0));
+}
+
+// ADC: single conversions started with ADSC
+static bool adc_converting = false;
+static bool adc_first = true;
+static uint64_t adc_done = 0;
+
+static void syncADC() {
+  if (!adc_converting && (ADCSRA & _BV(ADEN)) && (ADCSRA & _BV(ADSC))) {
+    // 13 ADC clocks, 25 for the first conversion after enabling the ADC
+    int prescaler = 1 << (ADCSRA & 0x07);
+    if (prescaler == 1) prescaler = 2;
+    adc_done = now + (adc_first ? 25 : 13) * prescaler;
+    adc_first = false;
+    adc_converting = true;
+  }
+}
+
+static void finishADC() {
+  int channel = (ADMUX & 0x07) | ((ADCSRB & _BV(MUX5)) ? 0x08 : 0);
+  ADC = analog_values[54 + channel];
+  adc_converting = false;
+  ADCSRA = (ADCSRA & ~_BV(ADSC)) | _BV(ADIF);
+}
+
+static void runPending() {
+  // like the hardware: one interrupt at a time, in vector order. The
+  // timer flag is cleared on entry, the UART interrupt is level triggered.
+  while (SREG & 0x80) {
+    void (*vector)(void) = 0;
+    if (timer1_pending) {
+      timer1_pending = false;
+      if (TIMSK1 & _BV(OCIE1A)) vector = TIMER1_COMPA_vect;
+    }
+    else if (timer0_pending) {
+      timer0_pending = false;
+      if ((TIMSK0 & _BV(OCIE0B)) && TIMER0_COMPB_vect) {
+        vector = TIMER0_COMPB_vect;
+      }
+    }
+    else if (uartReceivePending(0) && USART0_RX_vect) {
+      vector = USART0_RX_vect;
+    }
+    else if (uartEmptyPending(0) && USART0_UDRE_vect) {
+      vector = USART0_UDRE_vect;
+    }
+    else if ((ADCSRA & _BV(ADIF)) && (ADCSRA & _BV(ADIE)) && ADC_vect) {
+      ADCSRA &= ~_BV(ADIF);
+      vector = ADC_vect;
+    }
+    else if (uartReceivePending(1) && USART1_RX_vect) {
+      vector = USART1_RX_vect;
+    }
+    else if (uartEmptyPending(1) && USART1_UDRE_vect) {
+      vector = USART1_UDRE_vect;
+    }
+    else {
+      break;
+    }
+    if (vector) {
+      SREG &= ~0x80;
+      vector();
+      SREG |= 0x80;
+    }
+  }
+}
+
+void advance(uint64_t cycles) {
+  uint64_t end = now + cycles;
+  runPending();
+  for (;;) {
+    syncTimer1();
+    syncADC();
+    // earliest event: timer compare match, end of a conversion, a byte
+    // moving to a shifter or a byte arriving
+    uint64_t next = end + 1;
+    int source = -1;
+    if (timer1_running && timer1Next() < next) {
+      next = timer1Next();
+      source = 2;
+    }
+    if (!(TIMSK0 & _BV(OCIE0B))) {
+      // no backlog of matches while the interrupt is off
+      timer0_done = now;
+    }
+    else if (timer0Next() < next) {
+      next = timer0Next();
+      source = 6;
+    }
+    if (adc_converting && adc_done < next) {
+      next = adc_done;
+      source = 3;
+    }
+    for (int port=0;port<2;port++) {
+      if (uarts[port].udr_full && uarts[port].shifter_free < next) {
+        next = uarts[port].shifter_free;
+        source = port;
+      }
+      if (!uarts[port].incoming.empty()
+          && uarts[port].incoming.front().first < next) {
+        next = uarts[port].incoming.front().first;
+        source = 4 + port;
+      }
+    }
+    if (source < 0) break;
+    if (next > now) now = next;
+    if (source == 2) {
+      timer1_start = next;
+      timer1_pending = true;
+    }
+    else if (source == 3) {
+      finishADC();
+    }
+    else if (source == 6) {
+      timer0_done = next;
+      timer0_pending = true;
+    }
+    else if (source == 4 || source == 5) {
+      uartReceive(source - 4);
+    }
+    else {
+      uarts[source].udr_full = false;
+      uartShift(source, uarts[source].udr);
+    }
+    runPending();
+  }
+  if (now < end) now = end;
+}
+
+void setAnalog(int pin, int value) {
+  analog_values[pin] = value;
+}
+
+void setDigital(int pin, int value) {
+  digital_values[pin] = value;
+  digital_set[pin] = true;
+}
+
+// LCD
+static char lcd_chars[2][16];
+static int lcd_col = 0;
+static int lcd_row = 0;
+
+void dumpLCD(FILE* out) {
+  for (int r=0;r<2;r++) {
+    fprintf(out, "|%.16s|\n", lcd_chars[r]);
+  }
+}
+
+// EEPROM
+static uint8_t eeprom[4096];
+static bool eeprom_init = false;
+static uint64_t eeprom_busy = 0;
+
+static void eepromInit() {
+  if (!eeprom_init) {
+    memset(eeprom, 0xff, sizeof(eeprom));
+    eeprom_init = true;
+  }
+}
+
+static void eepromWait() {
+  if (eeprom_busy > now) advance(eeprom_busy - now);
+}
+
+bool loadEEPROM(const char* path) {
+  eepromInit();
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  size_t n = fread(eeprom, 1, sizeof(eeprom), f);
+  fclose(f);
+  return n == sizeof(eeprom);
+}
+
+bool saveEEPROM(const char* path) {
+  eepromInit();
+  FILE* f = fopen(path, "wb");
+  if (!f) return false;
+  size_t n = fwrite(eeprom, 1, sizeof(eeprom), f);
+  fclose(f);
+  return n == sizeof(eeprom);
+}
+
+}
+
+using namespace sim;
+
+uint8_t SREG = 0x80;
+volatile uint8_t TIMSK0;
+volatile uint8_t OCR0B;
+volatile uint8_t TCCR1A;
+volatile uint8_t TCCR1B;
+volatile uint8_t TIMSK1;
+Timer1Count TCNT1;
+volatile uint16_t OCR1A;
+static const int8_t port_a_pins[8] = {22, 23, 24, 25, 26, 27, 28, 29};
+static const int8_t port_e_pins[8] = {0, 1, -1, 5, 2, 3, -1, -1};
+static const int8_t port_g_pins[8] = {41, 40, 39, -1, -1, 4, -1, -1};
+static const int8_t port_h_pins[8] = {17, 16, -1, 6, 7, 8, 9, -1};
+PortInput PINA(port_a_pins);
+PortInput PINE(port_e_pins);
+PortInput PING(port_g_pins);
+PortInput PINH(port_h_pins);
+volatile uint8_t ADMUX;
+volatile uint8_t ADCSRA;
+volatile uint8_t ADCSRB;
+volatile uint16_t ADC;
+volatile uint8_t UCSR0A;
+volatile uint8_t UCSR0B;
+volatile uint8_t UCSR0C;
+volatile uint16_t UBRR0;
+UartData UDR0(PORT_USB);
+volatile uint8_t UCSR1A;
+volatile uint8_t UCSR1B;
+volatile uint8_t UCSR1C;
+volatile uint16_t UBRR1;
+UartData UDR1(PORT_DIN);
+
+void cli(void) {
+  SREG &= ~0x80;
+}
+
+void sei(void) {
+  SREG |= 0x80;
+  syncTimer1();
+  runPending();
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (mode == INPUT_PULLUP && !digital_set[pin]) digital_values[pin] = HIGH;
+}
+
+void digitalWrite(uint8_t, uint8_t) {
+  advance(4 * us);
+}
+
+PortInput::operator uint8_t() const {
+  uint8_t value = 0;
+  for (int bit=0;bit<8;bit++) {
+    if (pins[bit] >= 0 && digital_values[pins[bit]]) value |= _BV(bit);
+  }
+  return value;
+}
+
+int digitalRead(uint8_t pin) {
+  advance(4 * us);
+  return digital_values[pin];
+}
+
+int analogRead(uint8_t pin) {
+  // 13 ADC clocks at 125 kHz plus overhead
+  advance(112 * us);
+  return analog_values[pin];
+}
+
+void analogWrite(uint8_t, int) {
+  advance(4 * us);
+}
+
+unsigned long millis(void) {
+  return now / (F_CPU / 1000);
+}
+
+unsigned long micros(void) {
+  return now / us;
+}
+
+void delay(unsigned long ms) {
+  advance(ms * (F_CPU / 1000));
+}
+
+void delayMicroseconds(unsigned int n) {
+  advance(n * us);
+}
+
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+// Print
+size_t Print::write(const char* str) {
+  size_t n = 0;
+  while (*str) n += write((uint8_t) *str++);
+  return n;
+}
+
+size_t Print::print(const __FlashStringHelper* str) {
+  return write((const char*) str);
+}
+
+size_t Print::print(const char* str) {
+  return write(str);
+}
+
+size_t Print::print(char c) {
+  return write((uint8_t) c);
+}
+
+size_t Print::print(int n, int base) {
+  return print((long) n, base);
+}
+
+size_t Print::print(unsigned int n, int base) {
+  return print((unsigned long) n, base);
+}
+
+size_t Print::print(long n, int base) {
+  if (n < 0 && base == 10) {
+    return print('-') + print((unsigned long) -n, base);
+  }
+  return print((unsigned long) n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  char buf[33];
+  char* str = &buf[sizeof(buf) - 1];
+  *str = '\0';
+  do {
+    unsigned long digit = n % base;
+    n /= base;
+    *--str = digit < 10 ? '0' + digit : 'A' + digit - 10;
+  } while (n);
+  return write(str);
+}
+
+size_t Print::println(void) {
+  return write("\r\n");
+}
+
+Timer1Count& Timer1Count::operator=(uint16_t count) {
+  syncTimer1();
+  timer1_count = count;
+  timer1_start = now - (uint64_t) count * timer1Prescaler();
+  return *this;
+}
+
+Timer1Count::operator uint16_t() const {
+  syncTimer1();
+  if (!timer1_running) return timer1_count;
+  return (now - timer1_start) / timer1Prescaler();
+}
+
+// USART data registers
+UartData& UartData::operator=(uint8_t data) {
+  uartWrite(port, data);
+  return *this;
+}
+
+UartData::operator uint8_t() const {
+  return uartRead(port);
+}
+
+// LCD: every byte is sent as two nibbles, each followed by a 100 us pause
+void LiquidCrystal::begin(uint8_t, uint8_t) {
+  clear();
+}
+
+void LiquidCrystal::clear() {
+  memset(lcd_chars, ' ', sizeof(lcd_chars));
+  lcd_col = lcd_row = 0;
+  advance(2210 * us);
+}
+
+void LiquidCrystal::home() {
+  lcd_col = lcd_row = 0;
+  advance(2210 * us);
+}
+
+void LiquidCrystal::setCursor(uint8_t col, uint8_t row) {
+  lcd_col = col;
+  lcd_row = row < 2 ? row : 1;
+  advance(210 * us);
+}
+
+size_t LiquidCrystal::write(uint8_t c) {
+  if (lcd_col < 16) lcd_chars[lcd_row][lcd_col] = c;
+  lcd_col++;
+  advance(210 * us);
+  return 1;
+}
+
+// EEPROM
+EEPROMClass EEPROM;
+
+uint8_t EEPROMClass::read(int pos) {
+  eepromInit();
+  eepromWait();
+  return eeprom[pos & 0xfff];
+}
+
+void EEPROMClass::write(int pos, uint8_t data) {
+  eepromInit();
+  eepromWait();
+  eeprom[pos & 0xfff] = data;
+  eeprom_busy = now + 3300 * us;
+}
+
+bool eeprom_is_ready() {
+  // polling EECR takes a few cycles
+  advance(4);
+  return eeprom_busy <= now;
+}
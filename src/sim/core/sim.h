@@ -0,0 +1,61 @@
+/*
+ Arduino Drum Machine Firmware - host simulation
+ Copyright (C) 2015 Valentin Pratz
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+// Interface between the simulated core and the simulation driver
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace sim {
+
+const int PORT_USB = 0;
+const int PORT_DIN = 1;
+
+struct SerialByte {
+  uint64_t cycle; // CPU cycle the start bit leaves the UART
+  int port;
+  uint8_t data;
+};
+
+// virtual time in CPU cycles
+extern uint64_t now;
+inline unsigned long long cyclesToMicros(uint64_t c) { return c / 16; }
+
+// Let time pass, running the interrupts that become due
+void advance(uint64_t cycles);
+
+void setAnalog(int pin, int value);
+void setDigital(int pin, int value);
+
+extern std::vector<SerialByte> serial_log;
+
+// Byte arriving at a UART receiver at the given cycle (end of its stop
+// bit)
+void receive(int port, uint64_t cycle, uint8_t data);
+
+bool loadEEPROM(const char* path);
+bool saveEEPROM(const char* path);
+
+void dumpLCD(FILE* out);
+
+}
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ Arduino Drum Machine Firmware - host simulation
+ Copyright (C) 2015 Valentin Pratz
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+// Runs the sketch against the simulated core and writes every byte sent on
+// the serial ports with the time it leaves the UART.
+#include "sim.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void setup();
+void loop();
+
+struct PinEvent {
+  uint64_t cycle;
+  bool analog;
+  int pin;
+  int value;
+};
+
+struct ClockEvent {
+  uint64_t cycle;
+  double bpm; // 0 stops the clock
+};
+
+// one byte at 31250 baud
+const uint64_t din_byte_cycles = 10 * 16000000 / 31250;
+
+// cost of one pass through the Arduino main loop besides the sketch itself
+const uint64_t loop_overhead = 16 * 10;
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [-t seconds] [-o file] [-e eeprom]\n"
+          "       [-a pin=value[@ms]] [-d pin=value[@ms]]\n"
+          "       [-m hexbytes[@ms]] [-c bpm[@ms]] [-j us]\n"
+          "\n"
+          "  -t  simulated run time (default 10 s)\n"
+          "  -o  write the serial output to file instead of stdout\n"
+          "  -e  EEPROM image, loaded before and saved after the run\n"
+          "  -a  analog input value (0-1023, default 512)\n"
+          "  -d  digital input value (0 or 1), e.g. -d 23=0@2000\n"
+          "  -m  MIDI bytes received on DIN, e.g. -m fa@1000\n"
+          "  -c  MIDI clock received on DIN from ms on, 0 stops it\n"
+          "  -j  random jitter of the received clock, +-us\n",
+          name);
+}
+
+static int parsePin(const char* s) {
+  if (s[0] == 'A' || s[0] == 'a') return 54 + atoi(s + 1);
+  return atoi(s);
+}
+
+static bool parsePinEvent(const char* arg, bool analog, PinEvent* ev) {
+  const char* eq = strchr(arg, '=');
+  if (!eq) return false;
+  ev->analog = analog;
+  ev->pin = parsePin(arg);
+  ev->value = atoi(eq + 1);
+  const char* at = strchr(eq, '@');
+  ev->cycle = at ? (uint64_t) atol(at + 1) * 16000 : 0;
+  return ev->pin >= 0 && ev->pin < 70;
+}
+
+static bool parseMIDIEvent(const char* arg) {
+  const char* at = strchr(arg, '@');
+  uint64_t cycle = at ? (uint64_t) atol(at + 1) * 16000 : 0;
+  size_t len = at ? (size_t) (at - arg) : strlen(arg);
+  if (len == 0 || len % 2) return false;
+  for (size_t i=0;i<len;i+=2) {
+    char hex[3] = {arg[i], arg[i + 1], 0};
+    char* end;
+    long data = strtol(hex, &end, 16);
+    if (*end) return false;
+    sim::receive(sim::PORT_DIN, cycle + (i / 2 + 1) * din_byte_cycles, data);
+  }
+  return true;
+}
+
+static void addClock(std::vector<ClockEvent> clocks, double jitter_us,
+                     uint64_t end) {
+  /* Queue the clock bytes of all clock segments */
+  std::stable_sort(clocks.begin(), clocks.end(),
+                   [](const ClockEvent& a, const ClockEvent& b) {
+                     return a.cycle < b.cycle;
+                   });
+  std::vector<std::pair<uint64_t, uint8_t> > bytes;
+  srand(1);
+  for (size_t i=0;i<clocks.size();i++) {
+    if (clocks[i].bpm <= 0) continue;
+    uint64_t stop = i + 1 < clocks.size() ? clocks[i + 1].cycle : end;
+    double period = 16000000.0 * 60 / (clocks[i].bpm * 24);
+    for (double t=clocks[i].cycle;t<stop;t+=period) {
+      double offset = jitter_us * 16 * (2.0 * rand() / RAND_MAX - 1);
+      bytes.push_back(std::make_pair((uint64_t) (t + offset), 0xf8));
+    }
+  }
+  for (const std::pair<uint64_t, uint8_t>& b : bytes) {
+    sim::receive(sim::PORT_DIN, b.first, b.second);
+  }
+}
+
+int main(int argc, char** argv) {
+  double seconds = 10;
+  const char* out_path = NULL;
+  const char* eeprom_path = NULL;
+  std::vector<PinEvent> events;
+  std::vector<ClockEvent> clocks;
+  double jitter_us = 0;
+
+  for (int pin=54;pin<70;pin++) {
+    sim::setAnalog(pin, 512);
+  }
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:o:e:a:d:m:c:j:h")) != -1) {
+    PinEvent ev;
+    switch (opt) {
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'o':
+      out_path = optarg;
+      break;
+    case 'e':
+      eeprom_path = optarg;
+      break;
+    case 'a':
+    case 'd':
+      if (!parsePinEvent(optarg, opt == 'a', &ev)) {
+        usage(argv[0]);
+        return 1;
+      }
+      events.push_back(ev);
+      break;
+    case 'm':
+      if (!parseMIDIEvent(optarg)) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'c': {
+      const char* at = strchr(optarg, '@');
+      clocks.push_back({at ? (uint64_t) atol(at + 1) * 16000 : 0,
+                        atof(optarg)});
+      break;
+    }
+    case 'j':
+      jitter_us = atof(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const PinEvent& a, const PinEvent& b) {
+                     return a.cycle < b.cycle;
+                   });
+
+  if (eeprom_path) {
+    sim::loadEEPROM(eeprom_path);
+  }
+
+  size_t next_event = 0;
+  uint64_t end = (uint64_t) (seconds * 16000000);
+  addClock(clocks, jitter_us, end);
+  bool started = false;
+  while (sim::now < end) {
+    while (next_event < events.size() &&
+           events[next_event].cycle <= sim::now) {
+      const PinEvent& ev = events[next_event++];
+      if (ev.analog) sim::setAnalog(ev.pin, ev.value);
+      else sim::setDigital(ev.pin, ev.value);
+    }
+    if (!started) {
+      setup();
+      started = true;
+      continue;
+    }
+    loop();
+    sim::advance(loop_overhead);
+  }
+
+  FILE* out = stdout;
+  if (out_path) {
+    out = fopen(out_path, "w");
+    if (!out) {
+      perror(out_path);
+      return 1;
+    }
+  }
+  std::stable_sort(sim::serial_log.begin(), sim::serial_log.end(),
+                   [](const sim::SerialByte& a, const sim::SerialByte& b) {
+                     return a.cycle < b.cycle;
+                   });
+  fprintf(out, "# time_us port byte\n");
+  for (const sim::SerialByte& b : sim::serial_log) {
+    if (b.cycle >= end) break;
+    fprintf(out, "%llu %s %02x\n", sim::cyclesToMicros(b.cycle),
+            b.port == sim::PORT_DIN ? "din" : "usb", b.data);
+  }
+  if (out != stdout) fclose(out);
+
+  if (eeprom_path && !sim::saveEEPROM(eeprom_path)) {
+    perror(eeprom_path);
+  }
+  sim::dumpLCD(stderr);
+  return 0;
+}